@@ -2,7 +2,6 @@
 
 #include <fcntl.h>
 #include <math.h>
-#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -13,52 +12,7 @@
 #include <mutex>
 #include <string>
 
-#include "../checksum.h"
-
-void write_data(const std::vector<std::byte>& bytes_vec, const int wfd) {
-    int byte_len = bytes_vec.size();
-    // Convert the integer to an array of bytes
-    uint8_t bytes[2];
-    bytes[0] = static_cast<uint8_t>(byte_len & 0xFF);  // Least significant byte
-    bytes[1] = static_cast<uint8_t>((byte_len >> 8) & 0xFF);  // Second byte
-
-    if (write(wfd, bytes, 2) == -1) {
-        std::cerr << "Error writing number of bytes" << std::endl;
-    }
-    if (write(wfd, bytes_vec.data(), bytes_vec.size()) == -1) {
-        std::cerr << "Error writing : actual string" << std::endl;
-    }
-}
-
-std::string read_data(const int rfd) {
-    uint8_t len_buffer[2];
-    if (read(rfd, len_buffer, 2) == -1) {
-        std::cerr << "Error reading from pipe: Buffer length" << std::endl;
-        exit(1);
-    }
-
-    uint32_t length = static_cast<uint32_t>(len_buffer[1]) * 8 +
-                      static_cast<uint32_t>(len_buffer[0]);
-    char buffer[1024];
-    if (read(rfd, buffer, length) == -1) {
-        std::cerr << "Error reading from pipe: Actual message of length "
-                  << length << std::endl;
-        exit(1);
-    }
-
-    return std::string{buffer, length};
-}
-
-void try_create_fifo(const std::string& cpp_fifo_name,
-                     const std::string& python_fifo_name) {
-    std::filesystem::create_directories("pipe");
-    if (mkfifo(cpp_fifo_name.data(), S_IRWXU) == -1) {
-        perror("Error creating cpp.fifo");
-    }
-    if (mkfifo(python_fifo_name.data(), 0666) == -1) {
-        perror("Error creating python.fifo");
-    }
-}
+#include "ble_channel.h"
 
 void run_zephyr_server() {
     int status = std::system(
@@ -72,9 +26,10 @@ void run_zephyr_server() {
     exit(0);  // Exit the child process
 }
 
-void run_python_ble_tester() {
-    int status =
-        std::system("python3 run_ble_tester.py tcp-server:127.0.0.1:9000");
+void run_python_ble_tester(const BleChannel& channel) {
+    std::string command = "python3 run_ble_tester.py tcp-server:127.0.0.1:9000 " +
+                          ble_channel_args(channel);
+    int status = std::system(command.c_str());
 
     if (status != 0) {
         std::cerr << "Error executing python: " << std::endl;
@@ -83,31 +38,15 @@ void run_python_ble_tester() {
     exit(0);  // Exit the child process
 }
 
+// How long the tester may take to connect, discover and run the test case
+const int RESULT_TIMEOUT_MS = 30000;
+
 // Returns true if there is a problem. False if not.
-bool send_inputs_to_python(const int wfd, const int rfd,
+bool send_inputs_to_python(BleChannel& channel,
                            const std::vector<Input>& inputs) {
-    // std::cout << "Received from python: " << read_data(rfd) << std::endl;
-    int msg_count = inputs.size();
-    const std::vector<std::byte> msg_count_vec{
-        static_cast<std::byte>(msg_count & 0xFF),
-        static_cast<std::byte>((msg_count >> 8) & 0xFF)};
-    write_data(msg_count_vec, wfd);
-
-    int i = 1;
-    for (auto& input : inputs) {
-        if (read_data(rfd) == "end") {
-            std::cout << "Python told to end early. Exiting." << std::endl;
-            return true;
-        }
-        // std::cout << "Received from python: " << read_data(rfd) << std::endl;
-        write_data(input.data, wfd);
-        // std::cout << "Send to python: " << i << "th message" << std::endl;
-        i++;
-    }
-
-    if (read_data(rfd) == "end") {
-        std::cout << "Sent all messages, but last message got problem."
-                  << std::endl;
+    send_test_case(channel, inputs);
+    if (receive_result(channel, RESULT_TIMEOUT_MS) != BleResult::OK) {
+        std::cout << "Python told to end early. Exiting." << std::endl;
         return true;
     }
 
@@ -153,22 +92,15 @@ int run_driver(std::vector<Input>& inputs) {
     auto newpath = path / "BLEzephyr";
     std::filesystem::current_path(newpath);
 
-    std::string cpp_fifo_name = "./pipe/cpp.fifo";
-    std::string python_fifo_name = "./pipe/python.fifo";
-    // try_create_fifo(cpp_fifo_name, python_fifo_name);
-
+    auto channel = create_ble_channel();
     auto pid_1 = fork();  // First fork: BLE python
     if (pid_1 == 0) {
-        run_python_ble_tester();
+        run_python_ble_tester(channel);
     } else if (pid_1 < 0) {
         std::cerr << "Fork1 failed!" << std::endl;
         exit(1);
     }
 
-    // Connect with python pipe. Zephyr will be ready when python connected with the pipe
-    auto wfd = open(python_fifo_name.data(), O_WRONLY);
-    auto rfd = open(cpp_fifo_name.data(), O_RDONLY);
-
     auto pid_2 = fork();  // Second fork: Zephyr server
     if (pid_2 == 0) {
         run_zephyr_server();
@@ -177,10 +109,9 @@ int run_driver(std::vector<Input>& inputs) {
         exit(1);
     }
 
-    auto python_return_status = send_inputs_to_python(wfd, rfd, inputs);
+    auto python_return_status = send_inputs_to_python(channel, inputs);
     wait_python_exit(pid_1);
-    close(wfd);
-    close(rfd);
+    destroy_ble_channel(channel);
     auto zephyr_return_status = shutdown_zephyr_server(pid_2);
 
     std::filesystem::current_path(path);
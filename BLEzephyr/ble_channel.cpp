@@ -0,0 +1,136 @@
+#include "ble_channel.h"
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include "../shm.h"
+
+/**
+ * @brief Copies len bytes into the ring starting at byte offset pos, wrapping
+ * around the end of the data array.
+*/
+static void ring_copy_in(Ring* ring, uint32_t pos, const void* src,
+                         uint32_t len) {
+    uint32_t start = pos % ring->size;
+    uint32_t first = std::min(len, ring->size - start);
+    memcpy(ring->data + start, src, first);
+    memcpy(ring->data, static_cast<const char*>(src) + first, len - first);
+}
+
+static void ring_copy_out(const Ring* ring, uint32_t pos, void* dst,
+                          uint32_t len) {
+    uint32_t start = pos % ring->size;
+    uint32_t first = std::min(len, ring->size - start);
+    memcpy(dst, ring->data + start, first);
+    memcpy(static_cast<char*>(dst) + first, ring->data, len - first);
+}
+
+static void ring_push(Ring* ring, int event, const std::vector<uint8_t>& frame) {
+    uint32_t len = frame.size();
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (sizeof(len) + len > ring->size - (head - tail)) {
+        throw std::runtime_error("BLE test case does not fit in the ring");
+    }
+    ring_copy_in(ring, head, &len, sizeof(len));
+    ring_copy_in(ring, head + sizeof(len), frame.data(), len);
+    __atomic_store_n(&ring->head, head + sizeof(len) + len, __ATOMIC_RELEASE);
+
+    uint64_t one = 1;
+    if (write(event, &one, sizeof(one)) == -1) {
+        perror("Error signalling BLE tester");
+    }
+}
+
+// Returns false if there is no complete frame in the ring
+static bool ring_pop(Ring* ring, std::vector<uint8_t>& frame) {
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head - tail < sizeof(uint32_t))
+        return false;
+    uint32_t len;
+    ring_copy_out(ring, tail, &len, sizeof(len));
+    frame.resize(len);
+    ring_copy_out(ring, tail + sizeof(len), frame.data(), len);
+    __atomic_store_n(&ring->tail, tail + sizeof(len) + len, __ATOMIC_RELEASE);
+    return true;
+}
+
+BleChannel create_ble_channel() {
+    BleChannel channel;
+    channel.name = "/fuzz_ble_" + std::to_string(getpid()) + "_ring";
+    auto rings = static_cast<Ring*>(
+        create_shared_region(channel.name, 2 * sizeof(Ring)));
+    channel.to_python = &rings[0];
+    channel.to_cpp = &rings[1];
+    channel.to_python->size = RING_SIZE;
+    channel.to_cpp->size = RING_SIZE;
+
+    // Not close-on-exec, the tester gets them through the shell
+    channel.python_event = eventfd(0, 0);
+    channel.cpp_event = eventfd(0, 0);
+    if (channel.python_event == -1 || channel.cpp_event == -1) {
+        throw std::runtime_error("eventfd failed");
+    }
+    return channel;
+}
+
+void destroy_ble_channel(BleChannel& channel) {
+    close(channel.python_event);
+    close(channel.cpp_event);
+    remove_shared_region(channel.name);
+    channel = BleChannel{};
+}
+
+// Arguments that tell run_ble_tester.py where to find the channel
+std::string ble_channel_args(const BleChannel& channel) {
+    return channel.name + " " + std::to_string(channel.python_event) + " " +
+           std::to_string(channel.cpp_event);
+}
+
+/**
+ * @brief Sends a whole test case in one frame: the number of messages,
+ * then every message with a 2 byte length. The first message is the
+ * attribute handle the others are written to.
+*/
+void send_test_case(BleChannel& channel, const std::vector<Input>& inputs) {
+    std::vector<uint8_t> frame;
+    auto push_u16 = [&frame](size_t value) {
+        frame.push_back(value & 0xFF);
+        frame.push_back((value >> 8) & 0xFF);
+    };
+    push_u16(inputs.size());
+    for (auto& input : inputs) {
+        push_u16(input.data.size());
+        for (auto b : input.data)
+            frame.push_back(std::to_integer<uint8_t>(b));
+    }
+    ring_push(channel.to_python, channel.python_event, frame);
+}
+
+// A test case without messages tells a persistent tester to exit
+void send_quit(BleChannel& channel) {
+    ring_push(channel.to_python, channel.python_event, {0, 0});
+}
+
+/**
+ * @brief Waits for the tester to report on the last test case. Its answer is
+ * a status byte followed by the number of messages it got through.
+*/
+BleResult receive_result(BleChannel& channel, int timeout_ms) {
+    std::vector<uint8_t> frame;
+    while (!ring_pop(channel.to_cpp, frame)) {
+        struct pollfd pfd = {channel.cpp_event, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) != 1)
+            return BleResult::NO_ANSWER;
+        uint64_t count;
+        if (read(channel.cpp_event, &count, sizeof(count)) == -1)
+            return BleResult::NO_ANSWER;
+    }
+    if (frame.empty() || frame[0] != static_cast<uint8_t>(BleResult::OK))
+        return BleResult::TIMEOUT;
+    return BleResult::OK;
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "../inputs.h"
+
+const uint32_t RING_SIZE = 65536;
+
+/**
+ * @brief Single producer, single consumer ring of length prefixed frames in
+ * shared memory. head and tail count bytes and only ever grow, they are
+ * taken modulo size when indexing data.
+*/
+typedef struct {
+    uint32_t size;
+    uint32_t head;  // Written by the producer
+    uint32_t tail;  // Written by the consumer
+    uint32_t reserved;
+    char data[RING_SIZE];
+} Ring;
+
+/**
+ * @brief Link between the driver and run_ble_tester.py: one ring in each
+ * direction, each with an eventfd that is signalled after a frame was added.
+ * The eventfds are inherited by the tester.
+*/
+typedef struct {
+    std::string name;  // Of the shared memory object
+    Ring* to_python = nullptr;
+    Ring* to_cpp = nullptr;
+    int python_event = -1;
+    int cpp_event = -1;
+} BleChannel;
+
+// Status of a test case reported back by the tester
+enum class BleResult { OK = 0, TIMEOUT = 1, NO_ANSWER = 2 };
+
+BleChannel create_ble_channel();
+void destroy_ble_channel(BleChannel& channel);
+std::string ble_channel_args(const BleChannel& channel);
+
+void send_test_case(BleChannel& channel, const std::vector<Input>& inputs);
+void send_quit(BleChannel& channel);
+BleResult receive_result(BleChannel& channel, int timeout_ms);
@@ -0,0 +1,105 @@
+"""
+Python end of the shared memory link to the fuzzer, see ble_channel.h.
+
+The fuzzer creates two rings of length prefixed frames in one shared memory
+object, one for each direction, and an eventfd for each that is signalled
+after a frame was added. A test case arrives as a single frame and its result
+goes back as a single frame.
+"""
+import mmap
+import os
+import select
+import struct
+
+HEADER = struct.Struct('<IIII')  # size, head, tail, reserved
+RING_SIZE = 65536
+RING_BYTES = HEADER.size + RING_SIZE
+
+STATUS_OK = 0
+STATUS_TIMEOUT = 1
+
+
+class Ring:
+    def __init__(self, mm, offset):
+        self.mm = mm
+        self.offset = offset
+        self.data = offset + HEADER.size
+
+    def _field(self, index):
+        return struct.unpack_from('<I', self.mm, self.offset + 4 * index)[0]
+
+    def _set_field(self, index, value):
+        struct.pack_into('<I', self.mm, self.offset + 4 * index, value & 0xFFFFFFFF)
+
+    def _copy_out(self, pos, length):
+        size = self._field(0)
+        start = pos % size
+        first = min(length, size - start)
+        out = self.mm[self.data + start:self.data + start + first]
+        return out + self.mm[self.data:self.data + length - first]
+
+    def _copy_in(self, pos, payload):
+        size = self._field(0)
+        start = pos % size
+        first = min(len(payload), size - start)
+        self.mm[self.data + start:self.data + start + first] = payload[:first]
+        self.mm[self.data:self.data + len(payload) - first] = payload[first:]
+
+    def pop(self):
+        """Returns the next frame, or None if there is none yet"""
+        head, tail = self._field(1), self._field(2)
+        if (head - tail) & 0xFFFFFFFF < 4:
+            return None
+        length = struct.unpack('<I', self._copy_out(tail, 4))[0]
+        frame = self._copy_out(tail + 4, length)
+        self._set_field(2, tail + 4 + length)
+        return frame
+
+    def push(self, frame):
+        head = self._field(1)
+        self._copy_in(head, struct.pack('<I', len(frame)) + frame)
+        self._set_field(1, head + 4 + len(frame))
+
+
+class BleChannel:
+    def __init__(self, name, python_event, cpp_event):
+        self.name = name
+        fd = os.open(os.path.join('/dev/shm', name.lstrip('/')), os.O_RDWR)
+        self.mm = mmap.mmap(fd, 2 * RING_BYTES)
+        os.close(fd)
+        self.to_python = Ring(self.mm, 0)
+        self.to_cpp = Ring(self.mm, RING_BYTES)
+        self.python_event = python_event
+        self.cpp_event = cpp_event
+
+    def _fuzzer_gone(self):
+        return not os.path.exists(os.path.join('/dev/shm', self.name.lstrip('/')))
+
+    def receive_test_case(self):
+        """
+        Blocks until the next test case arrives and returns its messages, the
+        first being the attribute handle. An empty list means that the fuzzer
+        wants the tester to exit.
+        """
+        while True:
+            frame = self.to_python.pop()
+            if frame is not None:
+                break
+            if select.select([self.python_event], [], [], 1.0)[0]:
+                os.read(self.python_event, 8)
+            elif self._fuzzer_gone():
+                return []
+
+        count, = struct.unpack_from('<H', frame, 0)
+        messages = []
+        pos = 2
+        for _ in range(count):
+            length, = struct.unpack_from('<H', frame, pos)
+            messages.append(frame[pos + 2:pos + 2 + length])
+            pos += 2 + length
+        return messages
+
+    def send_result(self, status, done):
+        """Reports the status of the test case and how many messages got through"""
+        self.to_cpp.push(struct.pack('<BH', status, done))
+        os.write(self.cpp_event, (1).to_bytes(8, 'little'))
@@ -2,7 +2,8 @@
 
 #include <fcntl.h>
 #include <math.h>
-#include <sys/stat.h>
+#include <poll.h>
+#include <signal.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -13,76 +14,58 @@
 #include <mutex>
 #include <string>
 
-#include "../checksum.h"
+#include "ble_channel.h"
+#include "gcov_reader.h"
 
-void write_data(const std::vector<std::byte>& bytes_vec, const int wfd) {
-    int byte_len = bytes_vec.size();
-    // Convert the integer to an array of bytes
-    uint8_t bytes[2];
-    bytes[0] = static_cast<uint8_t>(byte_len & 0xFF);  // Least significant byte
-    bytes[1] = static_cast<uint8_t>((byte_len >> 8) & 0xFF);  // Second byte
-
-    if (write(wfd, bytes, 2) == -1) {
-        std::cerr << "Error writing number of bytes" << std::endl;
-    }
-    if (write(wfd, bytes_vec.data(), bytes_vec.size()) == -1) {
-        std::cerr << "Error writing : actual string" << std::endl;
-    }
+// HCI port the Zephyr server and the Python tester of this worker meet on
+std::string hci_address() {
+    return "127.0.0.1:" + std::to_string(9000 + worker_id);
 }
 
-std::string read_data(const int rfd) {
-    uint8_t len_buffer[2];
-    if (read(rfd, len_buffer, 2) == -1) {
-        std::cerr << "Error reading from pipe: Buffer length" << std::endl;
-        exit(1);
-    }
-
-    uint32_t length = static_cast<uint32_t>(len_buffer[1]) * 8 +
-                      static_cast<uint32_t>(len_buffer[0]);
-    char buffer[1024];
-    if (read(rfd, buffer, length) == -1) {
-        std::cerr << "Error reading from pipe: Actual message of length "
-                  << length << std::endl;
-        exit(1);
-    }
-
-    return std::string{buffer, length};
+// Worker 0 keeps the original layout. Other workers get their own flash
+// image and gcov output tree so that they don't trample on each other.
+std::string worker_suffix() {
+    return worker_id == 0 ? "" : std::to_string(worker_id);
 }
 
-void try_create_fifo(const std::string& cpp_fifo_name,
-                     const std::string& python_fifo_name) {
-    std::filesystem::create_directories("pipe");
+std::string gcov_directory() {
+    return worker_id == 0 ? "." : "./worker" + worker_suffix();
+}
 
-    if (access(cpp_fifo_name.data(), F_OK == -1)) {
-        if (mkfifo(cpp_fifo_name.data(), S_IRWXU) == -1) {
-            perror("Error creating cpp.fifo");
-        }
-    }
-    if (access(python_fifo_name.data(), F_OK == -1)) {
-        if (mkfifo(python_fifo_name.data(), 0666) == -1) {
-            perror("Error creating python.fifo");
-        }
+/**
+ * @brief Replaces the forked child with zephyr.exe, so that the parent can
+ * signal it directly.
+ *
+ * @param hook_fd Write end of the pipe on which the gcov hook acknowledges
+ * dumps, or -1 to run without the hook.
+*/
+void run_zephyr_server(const int hook_fd) {
+    auto prefix = std::filesystem::current_path() / gcov_directory();
+    setenv("GCOV_PREFIX", prefix.c_str(), 1);
+    setenv("GCOV_PREFIX_STRIP", "3", 1);
+    if (hook_fd != -1) {
+        auto hook = std::filesystem::current_path() / "gcov_hook.so";
+        setenv("LD_PRELOAD", hook.c_str(), 1);
+        setenv("GCOV_HOOK_FD", std::to_string(hook_fd).c_str(), 1);
     }
-}
 
-void run_zephyr_server() {
-    int status = std::system(
-        "GCOV_PREFIX=$(pwd) GCOV_PREFIX_STRIP=3 ./zephyr.exe "
-        "--bt-dev=127.0.0.1:9000 > /dev/null 2>&1");
+    int null_fd = open("/dev/null", O_WRONLY);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
 
-    if (status != 0) {
-        // std::cerr << "Error executing server: " << std::endl;
-        exit(1);
-    }
-    exit(0);  // Exit the child process
+    std::string bt_dev = "--bt-dev=" + hci_address();
+    std::string flash = "--flash=flash" + worker_suffix() + ".bin";
+    execl("./zephyr.exe", "./zephyr.exe", bt_dev.c_str(),
+          worker_id == 0 ? nullptr : flash.c_str(), nullptr);
+    exit(1);  // Only reached if zephyr.exe could not be started
 }
 
-void run_python_ble_tester() {
-    int status = std::system(
-        "python3 run_ble_tester.py tcp-server:127.0.0.1:9000  > /dev/null "
-        "2>&1");
-    // int status =
-    //     std::system("python3 run_ble_tester.py tcp-server:127.0.0.1:9000");
+void run_python_ble_tester(const BleChannel& channel) {
+    std::string command = "python3 run_ble_tester.py tcp-server:" +
+                          hci_address() + " " + ble_channel_args(channel) +
+                          (persistent_session ? " --persistent" : "") +
+                          " > /dev/null 2>&1";
+    int status = std::system(command.c_str());
 
     if (status != 0) {
         std::cerr << "Error executing python: " << std::endl;
@@ -92,35 +75,20 @@ void run_python_ble_tester() {
 }
 
 // Returns true if there is a problem. False if not.
-bool send_inputs_to_python(const int wfd, const int rfd,
-                           const std::vector<Input>& inputs) {
-    // std::cout << "Received from python: " << read_data(rfd) << std::endl;
-    int msg_count = inputs.size();
-    const std::vector<std::byte> msg_count_vec{
-        static_cast<std::byte>(msg_count & 0xFF),
-        static_cast<std::byte>((msg_count >> 8) & 0xFF)};
-    write_data(msg_count_vec, wfd);
-
-    int i = 1;
-    for (auto& input : inputs) {
-        if (read_data(rfd) == "end") {
+bool send_inputs_to_python(BleChannel& channel,
+                           const std::vector<Input>& inputs, int timeout_ms) {
+    send_test_case(channel, inputs);
+    switch (receive_result(channel, timeout_ms)) {
+        case BleResult::OK:
+            std::cout << "Successfully sent all messages." << std::endl;
+            return false;
+        case BleResult::TIMEOUT:
             std::cout << "Python told to end early. Exiting." << std::endl;
             return true;
-        }
-        // std::cout << "Received from python: " << read_data(rfd) << std::endl;
-        write_data(input.data, wfd);
-        // std::cout << "Send to python: " << i << "th message" << std::endl;
-        i++;
-    }
-
-    if (read_data(rfd) == "end") {
-        std::cout << "Sent all messages, but last message got problem."
-                  << std::endl;
-        return true;
+        default:
+            std::cout << "Python did not answer." << std::endl;
+            return true;
     }
-
-    std::cout << "Successfully sent all messages." << std::endl;
-    return false;
 }
 
 void wait_python_exit(const int pid) {
@@ -135,6 +103,13 @@ void wait_python_exit(const int pid) {
     }
 }
 
+// Only kill the Zephyr server of this worker, it is identified by its port
+void kill_zephyr_server() {
+    std::string command =
+        "pkill -15 -f './zephyr.exe --bt-dev=" + hci_address() + "'";
+    std::system(command.c_str());
+}
+
 bool shutdown_zephyr_server(const int pid) {
     int status;
     auto result = waitpid(pid, &status, WNOHANG);
@@ -150,117 +125,131 @@ bool shutdown_zephyr_server(const int pid) {
         return true;
     }
 
-    // Zephyr is still running. Kill it.
-    status = std::system("pkill -15 -f './zephyr.exe'");
+    // Zephyr is still running. Kill it and wait for it to write its .gcda files
+    kill_zephyr_server();
+    waitpid(pid, &status, 0);
     return false;
 }
 
-int get_last_digit(const std::string& str) {
-    if (str.back() == '-') {
-        return 0;
-    }
-
-    int i = 0;
-    for (auto it = str.rbegin(); *it != ','; it++) {
-        int temp = (*it - '0');
-        for (int x = 0; x < it - str.rbegin(); x++) {
-            temp *= 10;
-        }
-        i += temp;
-    }
-    return i;
+void get_coverage_data(coverage_map& shm) {
+    // The .gcno files don't change, so they are only parsed once
+    static GcovReader reader{"build", gcov_directory() + "/build"};
+    reader.read_new_counts(shm);
 }
 
-std::string get_branch_str(const std::string& str) {
-    int end = 0;
-    int comma_count = 0;
-
-    for (auto letter : str) {
-        if (letter == ',') {
-            comma_count++;
-        }
-        if (comma_count == 3) {
-            break;
-        }
-        end++;
+// A connected Zephyr/Bumble pair. Without a persistent session it only lives
+// for one input.
+typedef struct {
+    pid_t python_pid = -1;
+    pid_t zephyr_pid = -1;
+    BleChannel channel;
+    int hook_fd = -1;  // Read end of the gcov hook acks
+    int test_cases = 0;
+} BleSession;
+
+BleSession session;
+
+// How long a gcov dump may take before Zephyr is considered hung
+const int DUMP_TIMEOUT_MS = 2000;
+// How long the tester may take to answer. The first test case of a session
+// also waits for advertising, connection and GATT discovery. After that the
+// tester gives up after a second per write and per read.
+const int FIRST_RESULT_TIMEOUT_MS = 30000;
+const int RESULT_TIMEOUT_MS = 5000;
+const int MESSAGE_TIMEOUT_MS = 2000;
+
+void start_session() {
+    int hook_pipe[2] = {-1, -1};
+    if (persistent_session && pipe(hook_pipe) == -1) {
+        perror("Error creating gcov hook pipe");
+        exit(1);
     }
 
-    return str.substr(5, 5 - end);
-}
+    session.channel = create_ble_channel();
+    auto pid_1 = fork();  // First fork: BLE python
+    if (pid_1 == 0) {
+        run_python_ble_tester(session.channel);
+    } else if (pid_1 < 0) {
+        std::cerr << "Fork1 failed!" << std::endl;
+        exit(1);
+    }
 
-void get_coverage_data(std::array<char, SIZE>& shm) {
-    int status = std::system(
-        "lcov --capture --directory ./ --output-file lcov.info -q --rc "
-        "lcov_branch_coverage=1 > /dev/null 2>&1");
-    if (status != 0) {
-        std::cerr << "Error getting coverage data: " << std::endl;
+    auto pid_2 = fork();  // Second fork: Zephyr server
+    if (pid_2 == 0) {
+        if (hook_pipe[0] != -1)
+            close(hook_pipe[0]);
+        run_zephyr_server(hook_pipe[1]);
+    } else if (pid_2 < 0) {
+        std::cerr << "Fork2 failed!" << std::endl;
+        exit(1);
     }
-    // std::cout << "Main driver: Sucessfully gotten coverage data. Killing "
-    //              "zephyr again?"
-    //           << std::endl;
-    status = std::system("pkill -15 -f './zephyr.exe'");
+    if (hook_pipe[1] != -1)
+        close(hook_pipe[1]);
 
-    // Open the coverage file
-    std::ifstream inputFile{"./lcov.info"};
+    session.python_pid = pid_1;
+    session.zephyr_pid = pid_2;
+    session.hook_fd = hook_pipe[0];
+}
 
-    if (!inputFile.is_open()) {
-        std::cerr << "Failed to open the file." << std::endl;
-        return;
-    }
+// Returns true if Zephyr had crashed before it was stopped
+bool stop_session() {
+    auto zephyr_crashed = shutdown_zephyr_server(session.zephyr_pid);
+    // A persistent tester that is still waiting for test cases exits on this
+    if (persistent_session)
+        send_quit(session.channel);
+    wait_python_exit(session.python_pid);
+    destroy_ble_channel(session.channel);
+    if (session.hook_fd != -1)
+        close(session.hook_fd);
+    session = BleSession{};
+    return zephyr_crashed;
+}
 
-    std::string line;
-    std::string filename = "";
-    while (std::getline(inputFile, line)) {
-        if (line.substr(0, 2) == "SF") {
-            filename = line;
-        }
-        if (line.substr(0, 4) == "BRDA") {
-            auto to_hash = filename + get_branch_str(line);
-            auto hash =
-                crc_16(reinterpret_cast<const unsigned char*>(to_hash.data()),
-                       to_hash.length());
-            shm[hash] += get_last_digit(line);
-            // std::cout << "Wrote digit: " << get_last_digit(line) << " to index " << hash << std::endl;
-        }
-    }
-    inputFile.close();  // Close the file after reading
-    return;
+/**
+ * @brief Asks the gcov hook in the running Zephyr to write out its counters
+ * and waits until it has.
+ *
+ * @return False if Zephyr did not answer, it has crashed or hangs.
+*/
+bool dump_zephyr_coverage() {
+    if (kill(session.zephyr_pid, SIGUSR1) == -1)
+        return false;
+    struct pollfd pfd = {session.hook_fd, POLLIN, 0};
+    char ack;
+    return poll(&pfd, 1, DUMP_TIMEOUT_MS) == 1 &&
+           read(session.hook_fd, &ack, 1) == 1;
 }
 
-int run_driver(std::array<char, SIZE>& shm, std::vector<Input>& inputs) {
+int run_driver(coverage_map& shm, std::vector<Input>& inputs) {
     auto path = std::filesystem::current_path();  // getting path
     auto newpath = path / "BLEzephyr";
     std::filesystem::current_path(newpath);
 
-    std::string cpp_fifo_name = "./pipe/cpp.fifo";
-    std::string python_fifo_name = "./pipe/python.fifo";
-    try_create_fifo(cpp_fifo_name, python_fifo_name);
-
-    auto pid_1 = fork();  // First fork: BLE python
-    if (pid_1 == 0) {
-        run_python_ble_tester();
-    } else if (pid_1 < 0) {
-        std::cerr << "Fork1 failed!" << std::endl;
-        exit(1);
+    // The hook has to be built separately, as it needs a 32 bit toolchain
+    if (persistent_session && !std::filesystem::exists("gcov_hook.so")) {
+        std::cerr << "BLEzephyr/gcov_hook.so is missing, run `make "
+                     "gcov_hook`. Restarting Zephyr for every input."
+                  << std::endl;
+        persistent_session = false;
     }
 
-    // Connect with python pipe. HCI driver will be ready when python connected with the pipe
-    auto wfd = open(python_fifo_name.data(), O_WRONLY);
-    auto rfd = open(cpp_fifo_name.data(), O_RDONLY);
-
-    auto pid_2 = fork();  // Second fork: Zephyr server
-    if (pid_2 == 0) {
-        run_zephyr_server();
-    } else if (pid_2 < 0) {
-        std::cerr << "Fork2 failed!" << std::endl;
-        exit(1);
+    if (session.zephyr_pid == -1) {
+        start_session();
     }
 
-    auto python_return_status = send_inputs_to_python(wfd, rfd, inputs);
-    wait_python_exit(pid_1);
-    close(wfd);
-    close(rfd);
-    auto zephyr_return_status = shutdown_zephyr_server(pid_2);
+    int timeout_ms = session.test_cases++ == 0
+                         ? FIRST_RESULT_TIMEOUT_MS
+                         : RESULT_TIMEOUT_MS + MESSAGE_TIMEOUT_MS * inputs.size();
+    auto python_return_status =
+        send_inputs_to_python(session.channel, inputs, timeout_ms);
+    auto zephyr_return_status = false;
+    if (persistent_session && !python_return_status) {
+        zephyr_return_status = !dump_zephyr_coverage();
+    }
+    // Only a persistent session that is still healthy is kept for the next input
+    if (!persistent_session || python_return_status || zephyr_return_status) {
+        zephyr_return_status = stop_session() || zephyr_return_status;
+    }
     get_coverage_data(shm);
 
     std::filesystem::current_path(path);
@@ -273,6 +262,16 @@ int run_driver(std::array<char, SIZE>& shm, std::vector<Input>& inputs) {
     return 0;
 }
 
+// No structure-aware mutators, all fields go through the byte mutators
+bool mutate_structured(const Field&, std::vector<std::byte>&) {
+    return false;
+}
+
+// Zephyr and the tester are started per input by run_driver()
+ServerProbe server_probe() {
+    return {ProbeType::NONE, 0};
+}
+
 pid_t run_server() {
     auto pid = fork();
 
@@ -288,7 +287,7 @@ pid_t run_server() {
 
 // int main()
 // {
-//     std::array<char, SIZE> shm;
+//     coverage_map shm;
 //     std::vector<Input> inputs{};
 //     inputs.push_back(Input{std::vector<std::byte>{std::byte{0x06}}, ""});
 //     inputs.push_back(Input{std::vector<std::byte>{std::byte{0x01}, std::byte{0x02}, std::byte{0x03}}, ""});
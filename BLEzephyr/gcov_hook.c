@@ -0,0 +1,137 @@
+/*
+ * Preloaded into zephyr.exe so that its gcov counters can be written out
+ * while it keeps running, instead of only when it exits.
+ *
+ * On SIGUSR1 the counters are merged into the .gcda files and reset to zero,
+ * then one byte is written to the file descriptor in GCOV_HOOK_FD to tell the
+ * fuzzer that the files are complete. zephyr.exe is not built as a position
+ * independent executable and only links libgcov statically, so the libgcov
+ * internals are looked up in its symbol table.
+ *
+ * Build with `make gcov_hook`.
+ */
+#define _GNU_SOURCE
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>  // For ElfW
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DUMP_SIGNAL SIGUSR1
+
+/* Start of struct gcov_root in GCC 11 libgcov */
+struct gcov_root_head {
+    void* list;
+    unsigned dumped : 1;
+    unsigned run_counted : 1;
+};
+
+typedef struct {
+    void* start;
+    size_t size;
+} counter_range;
+
+static void (*dump_one)(struct gcov_root_head*);
+static struct gcov_root_head* root;
+static counter_range* counters;
+static size_t num_counters;
+
+static int ack_fd = -1;
+static int wake_pipe[2];
+
+/*
+ * Finds __gcov_dump_one, __gcov_root and the __gcov0.* counter arrays in the
+ * symbol table of the running executable.
+ */
+static int find_gcov_symbols(void) {
+    int fd = open("/proc/self/exe", O_RDONLY);
+    if (fd == -1)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return 0;
+    }
+    const char* image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+        return 0;
+
+    const ElfW(Ehdr)* ehdr = (const ElfW(Ehdr)*)image;
+    const ElfW(Shdr)* shdr = (const ElfW(Shdr)*)(image + ehdr->e_shoff);
+    for (int i = 0; i < ehdr->e_shnum; i++) {
+        if (shdr[i].sh_type != SHT_SYMTAB)
+            continue;
+        const ElfW(Sym)* syms = (const ElfW(Sym)*)(image + shdr[i].sh_offset);
+        size_t n = shdr[i].sh_size / sizeof(ElfW(Sym));
+        const char* names = image + shdr[shdr[i].sh_link].sh_offset;
+
+        counters = calloc(n, sizeof(counter_range));
+        for (size_t s = 0; s < n; s++) {
+            const char* name = names + syms[s].st_name;
+            void* addr = (void*)(uintptr_t)syms[s].st_value;
+            if (strcmp(name, "__gcov_dump_one") == 0) {
+                dump_one = (void (*)(struct gcov_root_head*))addr;
+            } else if (strcmp(name, "__gcov_root") == 0) {
+                root = addr;
+            } else if (strncmp(name, "__gcov0.", 8) == 0 && syms[s].st_size) {
+                counters[num_counters].start = addr;
+                counters[num_counters].size = syms[s].st_size;
+                num_counters++;
+            }
+        }
+    }
+    munmap((void*)image, st.st_size);
+    return dump_one && root;
+}
+
+static void on_dump_signal(int sig) {
+    (void)sig;
+    char c = 0;
+    (void)!write(wake_pipe[1], &c, 1);
+}
+
+/*
+ * libgcov is not async signal safe, so the dump happens on this thread
+ * rather than in the signal handler.
+ */
+static void* dump_thread(void* arg) {
+    (void)arg;
+    char c;
+    while (read(wake_pipe[0], &c, 1) == 1) {
+        root->dumped = 0;
+        dump_one(root);
+        for (size_t i = 0; i < num_counters; i++)
+            memset(counters[i].start, 0, counters[i].size);
+        // The final dump on exit should still write what is left
+        root->dumped = 0;
+        (void)!write(ack_fd, "d", 1);
+    }
+    return NULL;
+}
+
+__attribute__((constructor)) static void gcov_hook_init(void) {
+    const char* fd = getenv("GCOV_HOOK_FD");
+    if (!fd)
+        return;
+    ack_fd = atoi(fd);
+    if (!find_gcov_symbols() || pipe(wake_pipe) == -1)
+        return;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, dump_thread, NULL) != 0)
+        return;
+    pthread_detach(thread);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_dump_signal;
+    sa.sa_flags = SA_RESTART;
+    sigaction(DUMP_SIGNAL, &sa, NULL);
+}
@@ -0,0 +1,267 @@
+#include "gcov_reader.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include "../checksum.h"
+
+// Record layout of the GCC 11 gcov files, see gcc/gcov-io.h. Lengths are
+// counted in 32 bit words.
+const uint32_t GCNO_MAGIC = 0x67636e6f;  // "gcno"
+const uint32_t GCDA_MAGIC = 0x67636461;  // "gcda"
+const uint32_t TAG_FUNCTION = 0x01000000;
+const uint32_t TAG_BLOCKS = 0x01410000;
+const uint32_t TAG_ARCS = 0x01430000;
+const uint32_t TAG_ARC_COUNTS = 0x01a10000;
+const uint32_t FLAG_ON_TREE = 1;
+const uint32_t FLAG_FAKE = 2;
+
+// GCC numbers the entry block 0 and the exit block 1
+const uint32_t ENTRY_BLOCK = 0;
+const uint32_t EXIT_BLOCK = 1;
+
+static std::vector<uint32_t> read_words(const std::string& path) {
+    std::ifstream file{path, std::ios::binary | std::ios::ate};
+    if (!file.is_open())
+        return {};
+    std::vector<uint32_t> words(file.tellg() / sizeof(uint32_t));
+    file.seekg(0);
+    file.read(reinterpret_cast<char*>(words.data()),
+              words.size() * sizeof(uint32_t));
+    return words;
+}
+
+GcovReader::GcovReader(const std::string& gcno_directory,
+                       const std::string& gcda_directory) {
+    for (auto const& entry :
+         std::filesystem::recursive_directory_iterator{gcno_directory}) {
+        if (entry.path().extension() != ".gcno")
+            continue;
+        auto relative =
+            std::filesystem::relative(entry.path(), gcno_directory);
+        auto gcda = std::filesystem::path{gcda_directory} / relative;
+        gcda.replace_extension(".gcda");
+        load_gcno(entry.path().string(), gcda.string());
+    }
+
+    // The .gcda files may hold counts from earlier sessions, start from them
+    for (auto& file : files_)
+        read_gcda(file, nullptr);
+}
+
+void GcovReader::load_gcno(const std::string& gcno, const std::string& gcda) {
+    auto w = read_words(gcno);
+    if (w.size() < 4 || w[0] != GCNO_MAGIC) {
+        std::cerr << "Not a gcno file: " << gcno << std::endl;
+        return;
+    }
+
+    // Header: magic, version, stamp, working directory and a flag
+    size_t pos = 3;
+    pos += 1 + w[pos];
+    pos++;
+
+    File file{gcda, {}};
+    Function* fn = nullptr;
+    while (pos + 2 <= w.size()) {
+        uint32_t tag = w[pos];
+        size_t rec = pos + 2;
+        size_t end = rec + w[pos + 1];
+        if (end > w.size())
+            break;
+
+        if (tag == TAG_FUNCTION && end - rec >= 3) {
+            fn = &file.functions[w[rec]];
+            fn->lineno_checksum = w[rec + 1];
+            fn->cfg_checksum = w[rec + 2];
+        } else if (tag == TAG_BLOCKS && fn && end > rec) {
+            fn->num_blocks = w[rec];
+        } else if (tag == TAG_ARCS && fn && end > rec) {
+            uint32_t src = w[rec];
+            for (size_t i = rec + 1; i + 1 < end; i += 2) {
+                bool on_tree = w[i + 1] & FLAG_ON_TREE;
+                // Fake arcs are never branches, so mark them as such already
+                bool fake = w[i + 1] & FLAG_FAKE;
+                fn->arcs.push_back(Arc{src, w[i], on_tree, !fake, 0});
+            }
+        }
+        pos = end;
+    }
+
+    for (auto& [ident, f] : file.functions) {
+        // An extra arc from the exit back to the entry balances the flow
+        f.in.resize(f.num_blocks);
+        f.out.resize(f.num_blocks);
+        uint32_t back = f.arcs.size();
+        if (f.num_blocks > EXIT_BLOCK) {
+            f.out[EXIT_BLOCK].push_back(back);
+            f.in[ENTRY_BLOCK].push_back(back);
+        }
+
+        std::vector<int> successors(f.num_blocks, 0);
+        for (uint32_t i = 0; i < f.arcs.size(); i++) {
+            auto& arc = f.arcs[i];
+            if (arc.src >= f.num_blocks || arc.dst >= f.num_blocks)
+                continue;
+            f.out[arc.src].push_back(i);
+            f.in[arc.dst].push_back(i);
+            if (!arc.on_tree)
+                f.counter_arcs.push_back(i);
+            if (arc.branch)
+                successors[arc.src]++;
+        }
+
+        for (uint32_t i = 0; i < f.arcs.size(); i++) {
+            auto& arc = f.arcs[i];
+            arc.branch = arc.branch && arc.src < f.num_blocks &&
+                         successors[arc.src] > 1;
+            std::string key = gcno + ":" + std::to_string(ident) + ":" +
+                              std::to_string(i);
+            arc.index =
+                crc_16(reinterpret_cast<const unsigned char*>(key.data()),
+                       key.length());
+        }
+    }
+    files_.push_back(std::move(file));
+}
+
+/**
+ * @brief Fills in the counts of the arcs on the spanning tree, which gcov does
+ * not instrument, from the flow through every block. Counts of
+ * instrumented arcs must be set, the others are overwritten.
+ *
+ * @return Whether every arc could be solved.
+*/
+bool GcovReader::solve(const Function& fn, std::vector<int64_t>& counts) {
+    std::vector<bool> known(fn.arcs.size() + 1, false);
+    for (uint32_t i = 0; i < fn.arcs.size(); i++)
+        known[i] = !fn.arcs[i].on_tree;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t b = 0; b < fn.num_blocks; b++) {
+            int64_t sums[2] = {0, 0};
+            int unknown[2] = {0, 0};
+            uint32_t last[2] = {0, 0};
+            const std::vector<uint32_t>* sides[2] = {&fn.in[b], &fn.out[b]};
+            for (int s = 0; s < 2; s++) {
+                for (uint32_t arc : *sides[s]) {
+                    if (known[arc]) {
+                        sums[s] += counts[arc];
+                    } else {
+                        unknown[s]++;
+                        last[s] = arc;
+                    }
+                }
+            }
+
+            // The block count is known once either side is fully known
+            int64_t total;
+            if (unknown[0] == 0)
+                total = sums[0];
+            else if (unknown[1] == 0)
+                total = sums[1];
+            else
+                continue;
+
+            for (int s = 0; s < 2; s++) {
+                if (unknown[s] == 1) {
+                    counts[last[s]] = total - sums[s];
+                    known[last[s]] = true;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    for (bool k : known) {
+        if (!k)
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Reads the counters of one .gcda file and, if a map is given, adds
+ * the counts of the branches since the previous read to it.
+*/
+int GcovReader::read_gcda(File& file, coverage_map* shm) {
+    auto w = read_words(file.gcda);
+    if (w.size() < 3 || w[0] != GCDA_MAGIC)
+        return 0;
+
+    int taken = 0;
+    size_t pos = 3;  // Magic, version and stamp
+    Function* fn = nullptr;
+    while (pos + 2 <= w.size()) {
+        uint32_t tag = w[pos];
+        int32_t length = w[pos + 1];
+        size_t rec = pos + 2;
+        // A negative length marks counters that are all zero and not stored
+        size_t end = rec + (length > 0 ? length : 0);
+        if (end > w.size())
+            break;
+        pos = end;
+
+        if (tag == TAG_FUNCTION) {
+            fn = nullptr;
+            if (length < 3)
+                continue;
+            auto it = file.functions.find(w[rec]);
+            if (it != file.functions.end() &&
+                it->second.lineno_checksum == w[rec + 1] &&
+                it->second.cfg_checksum == w[rec + 2]) {
+                fn = &it->second;
+            }
+            continue;
+        }
+        if (tag != TAG_ARC_COUNTS || !fn)
+            continue;
+
+        size_t n = (length > 0 ? length : -length) / 2;
+        if (n != fn->counter_arcs.size())
+            continue;
+
+        std::vector<uint64_t> current(n, 0);
+        if (length > 0) {
+            for (size_t i = 0; i < n; i++) {
+                current[i] = w[rec + 2 * i] |
+                             static_cast<uint64_t>(w[rec + 2 * i + 1]) << 32;
+            }
+        }
+
+        // Counters that went down mean that the .gcda file was deleted
+        bool reset = fn->previous.size() != n;
+        for (size_t i = 0; !reset && i < n; i++)
+            reset = current[i] < fn->previous[i];
+        if (reset)
+            fn->previous.assign(n, 0);
+
+        if (shm) {
+            std::vector<int64_t> counts(fn->arcs.size() + 1, 0);
+            bool any = false;
+            for (size_t i = 0; i < n; i++) {
+                counts[fn->counter_arcs[i]] = current[i] - fn->previous[i];
+                any = any || counts[fn->counter_arcs[i]] != 0;
+            }
+            // Without any instrumented arc taken the function did not run
+            if (any && solve(*fn, counts)) {
+                for (uint32_t i = 0; i < fn->arcs.size(); i++) {
+                    if (fn->arcs[i].branch && counts[i] > 0) {
+                        add_hits((*shm)[fn->arcs[i].index], counts[i]);
+                        taken++;
+                    }
+                }
+            }
+        }
+        fn->previous = std::move(current);
+    }
+    return taken;
+}
+
+int GcovReader::read_new_counts(coverage_map& shm) {
+    int taken = 0;
+    for (auto& file : files_)
+        taken += read_gcda(file, &shm);
+    return taken;
+}
@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../driver.h"
+
+/**
+ * @brief Reads the gcov counters that Zephyr writes on exit, without going
+ * through lcov.
+ *
+ * The .gcno files are parsed once to learn the control flow graph of every
+ * function and which arcs are branches. After every run only the .gcda
+ * counters are read. Since gcov adds to the .gcda files on every exit, the
+ * counts of the previous read are kept and only the difference is reported.
+*/
+class GcovReader {
+   public:
+    /**
+     * @param gcno_directory Tree searched for .gcno files.
+     * @param gcda_directory Tree with the same layout where the .gcda files
+     * are written.
+    */
+    GcovReader(const std::string& gcno_directory,
+               const std::string& gcda_directory);
+
+    /**
+     * @brief Adds the branch counts of the last run to the coverage map.
+     *
+     * @return The number of branches taken in the last run.
+    */
+    int read_new_counts(coverage_map& shm);
+
+   private:
+    struct Arc {
+        uint32_t src, dst;
+        bool on_tree;    // Not instrumented, its count follows from the others
+        bool branch;     // Leaves a block with more than one real successor
+        uint16_t index;  // Slot in the coverage map
+    };
+
+    struct Function {
+        uint32_t lineno_checksum, cfg_checksum;
+        uint32_t num_blocks = 0;
+        std::vector<Arc> arcs;
+        std::vector<uint32_t> counter_arcs;  // Arc of every gcda counter
+        std::vector<std::vector<uint32_t>> in, out;  // Arcs per block
+        std::vector<uint64_t> previous;  // Counters at the previous read
+    };
+
+    struct File {
+        std::string gcda;
+        std::unordered_map<uint32_t, Function> functions;  // By ident
+    };
+
+    void load_gcno(const std::string& gcno, const std::string& gcda);
+    int read_gcda(File& file, coverage_map* shm);
+    static bool solve(const Function& fn, std::vector<int64_t>& counts);
+
+    std::vector<File> files_;
+};
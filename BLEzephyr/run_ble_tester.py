@@ -18,23 +18,12 @@ from bumble.transport import open_transport_or_link
 from bumble.utils import AsyncRunner
 from bumble.colors import color
 
-cpp_fifo_name = "./pipe/cpp.fifo"
-python_fifo_name = "./pipe/python.fifo"
+from ble_channel import BleChannel, STATUS_OK, STATUS_TIMEOUT
 
-# Open the FIFO pipe for reading
-rfd = 0
-wfd = 0
+# Shared memory link to the fuzzer
+channel = None
 hci_source = None
-
-def fifo_read(rfd):
-    msg_len = int.from_bytes(os.read(rfd, 2), byteorder='little')    
-    msg = os.read(rfd, msg_len)
-    return msg, msg_len
-
-def fifo_write(wfd, message):
-    len_bytes = int.to_bytes(len(message), length=2, byteorder='little')
-    os.write(wfd, len_bytes)
-    os.write(wfd, str.encode(message))
+persistent = False
 
 async def write_target(target, attribute, bytes):
     # Write
@@ -68,6 +57,45 @@ async def read_target(target, attribute):
     
     return False
 
+async def run_test_case(target, attributes):
+    """Runs one test case from the fuzzer. Returns False if the target stopped
+    answering or the fuzzer has gone."""
+    # Waiting for the next test case shouldn't block the BLE stack
+    messages = await asyncio.get_running_loop().run_in_executor(None, channel.receive_test_case)
+    if not messages:
+        return False
+    attribute_num = int.from_bytes(messages[0], byteorder='little')
+    print(f"Python said: Sending {len(messages) - 1} messages to attribute no. {attribute_num}")
+    
+    print('=== Read/Write Attributes (Handles)')
+    
+    correct_attribute = None
+    for attribute in attributes:
+        if(attribute_num == attribute.handle):
+            correct_attribute = attribute
+    
+    is_successful = True
+    
+    done = 0
+    for i, msg in enumerate(messages[1:]):
+        print(f"Python said: Thx for the {i+1}th message!\n Sending: [", end="")
+        for byte in msg:
+            print(f"0x{byte:02x}", end=", ")
+        print("]")
+
+        if(not(await write_target(target, correct_attribute, msg)) or not (await read_target(target, correct_attribute))):
+            print("Zephyr Server timed out. Ending early")
+            is_successful = False
+            break
+        done += 1
+    
+    channel.send_result(STATUS_OK if is_successful else STATUS_TIMEOUT, done)
+    
+    print('---------------------------------------------------------------')
+    print(color('[OK] Communication Finished', 'green'))
+    print('---------------------------------------------------------------')
+    return is_successful
+
 # -----------------------------------------------------------------------------
 class TargetEventsListener(Device.Listener):
 
@@ -109,53 +137,12 @@ class TargetEventsListener(Device.Listener):
         show_services(target.services)
         
         # -------- Main interaction with the target here --------
-        fifo_write(wfd, "Num messages (including attribute number msg)?")
-        msg, _ = fifo_read(rfd)
-        msg_count = int.from_bytes(msg, byteorder='little')
-        fifo_write(wfd, "Attribute?")
-        msg, _ = fifo_read(rfd)
-        attribute_num = int.from_bytes(msg, byteorder='little')
-        print(f"Python said: Sending {msg_count - 1} messages to attribute no. {attribute_num}")
-        
-        print('=== Read/Write Attributes (Handles)')
-        
-        correct_attribute = None
-        for attribute in attributes:
-            if(attribute_num == attribute.handle):
-                correct_attribute = attribute
-        
-        is_successful = True
-        
-        for i in range(msg_count - 1):
-            fifo_write(wfd, f"#{i+1} pls?")
-            msg, len = fifo_read(rfd)
-            
-            if(len == 0):
-                msg = []
-                
-            print(f"Python said: Thx for the {i+1}th message!\n Sending: [", end="")
-            for byte in msg:
-                print(f"0x{byte:02x}", end=", ")
-            print("]")
-
-            if(not(await write_target(target, correct_attribute, msg)) or not (await read_target(target, correct_attribute))):
-                print("Zephyr Server timed out. Ending early")
-                fifo_write(wfd, f"end")
-                is_successful = False
-                break
-        
-        if(is_successful):
-            fifo_write(wfd, "ok")
-        else:
-            fifo_write(wfd, "end")
-        
-        print('---------------------------------------------------------------')
-        print(color('[OK] Communication Finished', 'green'))
-        print('---------------------------------------------------------------')
-        print(f"Python said: Received all messages.... closing pipes...")
-        os.close(wfd)
-        os.close(rfd)
-        print(f"Python said: Pipe closed. Exiting...")
+        # A persistent tester stays connected and runs test cases until the
+        # fuzzer tells it to quit or the target stops answering
+        while await run_test_case(target, attributes) and persistent:
+            pass
+
+        print(f"Python said: Received all messages. Exiting...")
         
         hci_source.terminated.set_result("Done")
         # ---------------------------------------------------
@@ -164,11 +151,21 @@ class TargetEventsListener(Device.Listener):
 
 # -----------------------------------------------------------------------------
 async def main():
-    if len(sys.argv) != 2:
-        print('Usage: run_controller.py <transport-address>')
-        print('example: ./run_ble_tester.py tcp-server:0.0.0.0:9000')
+    # With --persistent, keep the connection for many test cases
+    global persistent
+    if '--persistent' in sys.argv:
+        persistent = True
+        sys.argv.remove('--persistent')
+
+    if len(sys.argv) != 5:
+        print('Usage: run_controller.py <transport-address> <shm-name> <python-eventfd> <cpp-eventfd> [--persistent]')
+        print('example: ./run_ble_tester.py tcp-server:0.0.0.0:9000 /fuzz_ble_1234_ring 3 4')
         return
 
+    # Each fuzzing worker has its own channel
+    global channel
+    channel = BleChannel(sys.argv[2], int(sys.argv[3]), int(sys.argv[4]))
+
     print('>>> Waiting connection to HCI...')
     
     global hci_source
@@ -199,11 +196,6 @@ async def main():
 
         print('Waiting Advertisment from BLE Target')
         
-        global rfd
-        global wfd
-        rfd = os.open(python_fifo_name, os.O_RDONLY)
-        wfd = os.open(cpp_fifo_name, os.O_WRONLY)
-        
         while device.listener.got_advertisement is False:
             await asyncio.sleep(0.5)
         await device.stop_scanning() # Stop scanning for targets
@@ -17,86 +17,7 @@
 #include <vector>
 #include "../checksum.h"
 #include "../bug_checking.h"
-
-// Function to construct the CoAP message using the Input vector.
-std::vector<uint8_t> createCoapMessage(const std::vector<Input>& inputs) {
-    uint8_t ver = 0x01;   // Default version is 1
-    uint8_t type = 0x00;  // Default type is 0 (CON)
-    uint8_t tkl = 0x00;   // Initialize TKL to zero
-    uint8_t code = 0x00;  // Initialize Code to zero
-    std::vector<uint8_t> messageId;
-    std::vector<uint8_t> token;
-    std::vector<uint8_t> uri_path;
-    std::vector<uint8_t> options;
-    std::vector<uint8_t> payload;
-
-    // Parse inputs to collect CoAP fields
-    for (const auto& input : inputs) {
-        if (input.name == "Type") {
-            type = std::to_integer<uint8_t>(input.data[0]);
-        } else if (input.name == "TKL") {
-            tkl = std::to_integer<uint8_t>(input.data[0]);
-        } else if (input.name == "Code") {
-            code = std::to_integer<uint8_t>(input.data[0]);
-        } else if (input.name == "MessageID") {
-            for (auto& b : input.data) {
-                messageId.push_back(std::to_integer<uint8_t>(b));
-            }
-        } else if (input.name == "Token") {
-            for (auto& b : input.data) {
-                token.push_back(std::to_integer<uint8_t>(b));
-            }
-        } else if (input.name == "Uri-Path") {
-            // Need to check the size of the Uri-Path to determine if it needs to be extended or not
-            if (input.data.size() > 12) {
-                // if the Uri-Path is longer than 12 bytes, the option header needs to be extended
-                uri_path.push_back(
-                    0xBD);  // "B" to mark the URI-Path option, and "D" to indicate the extension
-                uri_path.push_back(
-                    input.data.size() -
-                    13);  // The length of the extended URI-Path (minus the first 13 bytes)
-            } else {
-                // No extension needed, construct the normal header
-                uri_path.push_back((
-                    0xB0 +
-                    input.data
-                        .size()));  // "B" to mark the URI-Path option, and the last 4 bits is the length
-            }
-
-            for (auto& b : input.data) {
-                uri_path.push_back(std::to_integer<uint8_t>(b));
-            }
-        } else if (input.name == "Options") {
-            // Here we would need to implement logic to correctly serialize the options
-        } else if (input.name == "Payload") {
-            // Payload is preceded by a marker if there is a payload and options are present
-            if (!input.data.empty()) {
-                payload.push_back(0xFF);  // Payload marker
-                for (auto& b : input.data) {
-                    payload.push_back(std::to_integer<uint8_t>(b));
-                }
-            }
-        }
-    }
-
-    // Ensure TKL matches the token length
-    tkl = static_cast<uint8_t>(
-        token
-            .size());  // Ensure this happens after the last modification to `token`
-
-    // Construct the message header
-    uint8_t header = (ver << 6) | (type << 4) | tkl;
-
-    // Construct the complete CoAP message
-    std::vector<uint8_t> message;
-    message.push_back(header);
-    message.push_back(code);
-    message.insert(message.end(), messageId.begin(), messageId.end());
-    message.insert(message.end(), token.begin(), token.end());
-    message.insert(message.end(), uri_path.begin(), uri_path.end());
-    message.insert(message.end(), payload.begin(), payload.end());
-    return message;
-}
+#include "coap_message.h"
 
 int sendUdpMessage(const std::string& host, uint16_t port,
                    const std::vector<uint8_t>& message) {
@@ -0,0 +1,200 @@
+#include "coap_message.h"
+#include <cstdint>
+#include <vector>
+
+// Record header in the "Options" field: number, quirk and value length
+const size_t OPTION_RECORD_HEADER = 5;
+
+const uint16_t URI_PATH_OPTION = 11;
+
+size_t decode_options(const std::vector<std::byte>& data,
+                      std::vector<CoapOption>& options) {
+    auto byte_at = [&](size_t i) { return std::to_integer<uint8_t>(data[i]); };
+
+    size_t count = 0;
+    size_t pos = 0;
+    while (pos + OPTION_RECORD_HEADER <= data.size()) {
+        uint32_t length = byte_at(pos + 3) << 8 | byte_at(pos + 4);
+        if (pos + OPTION_RECORD_HEADER + length > data.size())
+            break;
+
+        // Options keep their value buffers when the vector is reused
+        if (options.size() == count)
+            options.emplace_back();
+        CoapOption& option = options[count++];
+        option.number = byte_at(pos) << 8 | byte_at(pos + 1);
+        option.quirk = static_cast<OptionQuirk>(
+            byte_at(pos + 2) % static_cast<uint8_t>(OptionQuirk::COUNT));
+        const std::byte* value = data.data() + pos + OPTION_RECORD_HEADER;
+        option.value.resize(length);
+        for (uint32_t i = 0; i < length; i++)
+            option.value[i] = std::to_integer<uint8_t>(value[i]);
+        pos += OPTION_RECORD_HEADER + length;
+    }
+    return count;
+}
+
+void encode_options(const std::vector<CoapOption>& options, size_t count,
+                    std::vector<std::byte>& data) {
+    data.clear();
+    for (size_t i = 0; i < count; i++) {
+        const CoapOption& option = options[i];
+        data.push_back(static_cast<std::byte>(option.number >> 8));
+        data.push_back(static_cast<std::byte>(option.number));
+        data.push_back(static_cast<std::byte>(option.quirk));
+        data.push_back(static_cast<std::byte>(option.value.size() >> 8));
+        data.push_back(static_cast<std::byte>(option.value.size()));
+        for (uint8_t b : option.value)
+            data.push_back(static_cast<std::byte>(b));
+    }
+}
+
+// Nibble of an option delta or length, 13 and 14 announce 1 or 2 extended
+// bytes (RFC 7252, section 3.1)
+static uint8_t option_nibble(uint32_t value) {
+    if (value < 13)
+        return value;
+    if (value < 269)
+        return 13;
+    return 14;
+}
+
+static void put_extended(uint8_t nibble, uint32_t value,
+                         std::vector<uint8_t>& message) {
+    if (nibble == 13) {
+        message.push_back(value - 13);
+    } else if (nibble == 14) {
+        message.push_back((value - 269) >> 8);
+        message.push_back(value - 269);
+    }
+}
+
+void serialize_options(const std::vector<CoapOption>& options,
+                       std::vector<uint8_t>& message) {
+    uint16_t last_number = 0;
+    for (const auto& option : options) {
+        // Going back to a lower number wraps around, the 2 byte form holds
+        // deltas up to 65804
+        uint32_t delta = static_cast<uint16_t>(option.number - last_number);
+        uint32_t length = option.value.size();
+        last_number = option.number;
+
+        switch (option.quirk) {
+            case OptionQuirk::LENGTH_OVERRUN:
+                length += 13;
+                break;
+            case OptionQuirk::LENGTH_UNDERRUN:
+                length /= 2;
+                break;
+            case OptionQuirk::LENGTH_MAX:
+                length = 269 + 0xFFFF;
+                break;
+            default:
+                break;
+        }
+
+        uint8_t delta_nibble = option_nibble(delta);
+        uint8_t length_nibble = option_nibble(length);
+        if (option.quirk == OptionQuirk::RESERVED_NIBBLE)
+            delta_nibble = 15;
+        if (option.quirk == OptionQuirk::TRUNCATED)
+            length_nibble = 14;
+
+        message.push_back(delta_nibble << 4 | length_nibble);
+        put_extended(delta_nibble, delta, message);
+        if (option.quirk == OptionQuirk::TRUNCATED) {
+            // One of the two extended length bytes, nothing after it
+            message.push_back(0);
+            return;
+        }
+        put_extended(length_nibble, length, message);
+        message.insert(message.end(), option.value.begin(),
+                       option.value.end());
+    }
+}
+
+// Function to construct the CoAP message using the Input vector.
+std::vector<uint8_t> createCoapMessage(const std::vector<Input>& inputs) {
+    // Placeholder for header fields
+    uint8_t ver = 0x01;   // Default version is 1
+    uint8_t type = 0x00;  // Default type is 0 (CON)
+    uint8_t tkl = 0x00;   // Initialize TKL to zero
+    uint8_t code = 0x00;  // Initialize Code to zero
+    std::vector<uint8_t> messageId;
+    std::vector<uint8_t> token;
+    std::vector<uint8_t> payload;
+
+    // Reused between messages, like the buffers of the mutators
+    static std::vector<CoapOption> options;
+    static CoapOption uri_path;
+    bool has_uri_path = false;
+    bool has_tkl = false;
+    options.clear();
+
+    // Parse inputs to collect CoAP fields
+    for (const auto& input : inputs) {
+        if (input.name == "Type") {
+            type = std::to_integer<uint8_t>(input.data[0]);
+        } else if (input.name == "TKL" && !input.data.empty()) {
+            tkl = std::to_integer<uint8_t>(input.data[0]);
+            has_tkl = true;
+        } else if (input.name == "Code") {
+            code = std::to_integer<uint8_t>(input.data[0]);
+        } else if (input.name == "MessageID") {
+            for (auto& b : input.data) {
+                messageId.push_back(std::to_integer<uint8_t>(b));
+            }
+        } else if (input.name == "Token") {
+            for (auto& b : input.data) {
+                token.push_back(std::to_integer<uint8_t>(b));
+            }
+        } else if (input.name == "Uri-Path") {
+            // The whole path goes into a single Uri-Path option
+            uri_path.number = URI_PATH_OPTION;
+            uri_path.quirk = OptionQuirk::NONE;
+            uri_path.value.clear();
+            for (auto& b : input.data) {
+                uri_path.value.push_back(std::to_integer<uint8_t>(b));
+            }
+            has_uri_path = true;
+        } else if (input.name == "Options") {
+            options.resize(decode_options(input.data, options));
+        } else if (input.name == "Payload") {
+            // Payload is preceded by a marker if there is a payload and options are present
+            if (!input.data.empty()) {
+                payload.push_back(0xFF);  // Payload marker
+                for (auto& b : input.data) {
+                    payload.push_back(std::to_integer<uint8_t>(b));
+                }
+            }
+        }
+    }
+
+    // Uri-Path goes before the first option with a higher number, so that
+    // options in order stay in order
+    if (has_uri_path) {
+        size_t at = 0;
+        while (at < options.size() && options[at].number <= URI_PATH_OPTION)
+            at++;
+        options.insert(options.begin() + at, uri_path);
+    }
+
+    // TKL is computed from the token by the fix-ups of the config, and left
+    // as mutated when they are skipped. Without the field it is the token
+    // length.
+    if (!has_tkl)
+        tkl = static_cast<uint8_t>(token.size());
+
+    // Construct the message header
+    uint8_t header = (ver << 6) | (type << 4) | (tkl & 0x0F);
+
+    // Construct the complete CoAP message
+    std::vector<uint8_t> message;
+    message.push_back(header);
+    message.push_back(code);
+    message.insert(message.end(), messageId.begin(), messageId.end());
+    message.insert(message.end(), token.begin(), token.end());
+    serialize_options(options, message);
+    message.insert(message.end(), payload.begin(), payload.end());
+    return message;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "../inputs.h"
+
+// How an option is put on the wire. Everything but NONE gives a malformed
+// message, to test how the server copes with broken encodings.
+enum class OptionQuirk : uint8_t {
+    NONE,
+    LENGTH_OVERRUN,   // Length claims 13 more bytes than the value has
+    LENGTH_UNDERRUN,  // Length claims half the value, the rest reads as options
+    LENGTH_MAX,       // Length in the 2 byte extended form, at its maximum
+    RESERVED_NIBBLE,  // Delta nibble 15, reserved for the payload marker
+    TRUNCATED,        // Extended length cut off, ends the options
+    COUNT
+};
+
+typedef struct {
+    uint16_t number;
+    OptionQuirk quirk;
+    std::vector<uint8_t> value;
+} CoapOption;
+
+/**
+ * @brief Options are kept in an "Options" field as records of the option
+ * number (2 bytes, big endian), its quirk (1 byte), the value length
+ * (2 bytes, big endian) and the value. Reading stops at the first
+ * incomplete record, so byte level mutations of the field stay readable.
+ * Decoding returns the number of options read into the front of the vector.
+ * Options past them are left as they were, so that their value buffers can
+ * be used again.
+*/
+size_t decode_options(const std::vector<std::byte>& data,
+                      std::vector<CoapOption>& options);
+void encode_options(const std::vector<CoapOption>& options, size_t count,
+                    std::vector<std::byte>& data);
+
+/**
+ * @brief Appends options to a message. Deltas are taken between options in
+ * the given order, one going back wraps around to a large delta.
+*/
+void serialize_options(const std::vector<CoapOption>& options,
+                       std::vector<uint8_t>& message);
+
+// Builds the CoAP message of the fields of an input
+std::vector<uint8_t> createCoapMessage(const std::vector<Input>& inputs);
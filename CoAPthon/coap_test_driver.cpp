@@ -1,9 +1,9 @@
 #include <arpa/inet.h>  // For inet_pton and htons
 #include <fcntl.h>
-#include <sqlite3.h>
 #include <sys/select.h>  // For select() and FD_SET
 #include <sys/socket.h>  // For socket, sendto, and close
 #include <unistd.h>      // For close
+#include <algorithm>
 #include <array>
 #include <cerrno>   // For errno
 #include <chrono>   // For system_clock
@@ -15,161 +15,15 @@
 #include <stdexcept>  // Include for std::runtime_error
 #include <string>
 #include <vector>
-#include "../checksum.h"
+#include "../coverage_db.h"
 #include "../driver.h"
-
-// Input structure containing data and its associated name.
-
-int hash_cov_into_shm(std::array<char, SIZE>& shm, const char* filename) {
-    sqlite3* db;
-    char* zErrMsg = 0;
-    int rc;
-    rc = sqlite3_open(filename, &db);
-    if (rc) {
-        fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-        return (0);
-    } else {
-        // fprintf(stderr, "Opened database successfully\n");
-    }
-
-    const char* sql = "SELECT * from arc";
-    sqlite3_stmt* stmt;
-    sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    int ncols = sqlite3_column_count(stmt);
-    int res;
-    do {
-        res = sqlite3_step(stmt);
-        uint16_t crc = 0;
-        for (int i = 0; i < ncols; i++) {
-            int item = sqlite3_column_int(stmt, i);
-            crc = update_crc_16(crc, item);
-        }
-        shm[crc]++;
-    } while (res == SQLITE_ROW);
-    sqlite3_finalize(stmt);
-    int res1 = sqlite3_close(db);
-    return 0;
-}
-
-// Function to construct the CoAP message using the Input vector.
-std::vector<uint8_t> createCoapMessage(const std::vector<Input>& inputs) {
-    // Placeholder for header fields
-    uint8_t ver = 0x01;   // Default version is 1
-    uint8_t type = 0x00;  // Default type is 0 (CON)
-    uint8_t tkl = 0x00;   // Initialize TKL to zero
-    uint8_t code = 0x00;  // Initialize Code to zero
-    std::vector<uint8_t> messageId;
-    std::vector<uint8_t> token;
-    std::vector<uint8_t> uri_path;
-    std::vector<uint8_t> options;
-    std::vector<uint8_t> payload;
-
-    // Parse inputs to collect CoAP fields
-    for (const auto& input : inputs) {
-        if (input.name == "Type") {
-            type = std::to_integer<uint8_t>(input.data[0]);
-        } else if (input.name == "TKL") {
-            tkl = std::to_integer<uint8_t>(input.data[0]);
-        } else if (input.name == "Code") {
-            code = std::to_integer<uint8_t>(input.data[0]);
-        } else if (input.name == "MessageID") {
-            for (auto& b : input.data) {
-                messageId.push_back(std::to_integer<uint8_t>(b));
-            }
-        } else if (input.name == "Token") {
-            for (auto& b : input.data) {
-                token.push_back(std::to_integer<uint8_t>(b));
-            }
-        } else if (input.name == "Uri-Path") {
-            // Need to check the size of the Uri-Path to determine if it needs to be extended or not
-            if (input.data.size() > 12) {
-                // if the Uri-Path is longer than 12 bytes, the option header needs to be extended
-                uri_path.push_back(
-                    0xBD);  // "B" to mark the URI-Path option, and "D" to indicate the extension
-                uri_path.push_back(
-                    input.data.size() -
-                    13);  // The length of the extended URI-Path (minus the first 13 bytes)
-            } else {
-                // No extension needed, construct the normal header
-                uri_path.push_back((
-                    0xB0 +
-                    input.data
-                        .size()));  // "B" to mark the URI-Path option, and the last 4 bits is the length
-            }
-
-            for (auto& b : input.data) {
-                uri_path.push_back(std::to_integer<uint8_t>(b));
-            }
-        } else if (input.name == "Options") {
-            // Here we would need to implement logic to correctly serialize the options
-        } else if (input.name == "Payload") {
-            // Payload is preceded by a marker if there is a payload and options are present
-            if (!input.data.empty()) {
-                payload.push_back(0xFF);  // Payload marker
-                for (auto& b : input.data) {
-                    payload.push_back(std::to_integer<uint8_t>(b));
-                }
-            }
-        }
-    }
-
-    // Ensure TKL matches the token length
-    tkl = static_cast<uint8_t>(
-        token
-            .size());  // Ensure this happens after the last modification to `token`
-    // std::cout << "Current Token Length: " << token.size() << std::endl;
-
-    // Construct the message header
-    uint8_t header = (ver << 6) | (type << 4) | tkl;
-
-    // Construct the complete CoAP message
-    std::vector<uint8_t> message;
-    message.push_back(header);
-    // std::cout << std::hex << std::setw(2) << std::setfill('0');
-    // for (uint8_t byte : message) {
-    //     std::cout << static_cast<int>(byte) << ' ';
-    // }
-    // std::cout << std::endl;
-
-    message.push_back(code);
-    // for (uint8_t byte : message) {
-    //     std::cout << static_cast<int>(byte) << ' ';
-    // }
-    // std::cout << std::endl;
-
-    message.insert(message.end(), messageId.begin(), messageId.end());
-    // for (uint8_t byte : message) {
-    //     std::cout << static_cast<int>(byte) << ' ';
-    // }
-    // std::cout << std::endl;
-
-    message.insert(message.end(), token.begin(), token.end());
-    // for (uint8_t byte : message) {
-    //     std::cout << static_cast<int>(byte) << ' ';
-    // }
-    // std::cout << std::endl;
-    // Options would be added here, after implementing options serialization logic
-
-    message.insert(message.end(), uri_path.begin(), uri_path.end());
-    // for (uint8_t byte : message) {
-    //     std::cout << static_cast<int>(byte) << ' ';
-    // }
-    // std::cout << std::endl;
-
-    message.insert(message.end(), payload.begin(), payload.end());
-    // for (uint8_t byte : message) {
-    //     std::cout << static_cast<int>(byte) << ' ';
-    // }
-    // std::cout << std::endl;
-    // std::cout << std::dec << std::setw(0) << std::setfill(' ');
-
-    return message;
-}
+#include "../rng.h"
+#include "coap_message.h"
 
 // Function to send the message over UDP.
 int sendUdpMessage(const std::string& host, uint16_t port,
                    const std::vector<uint8_t>& message,
-                   std::array<char, SIZE>& shm) {
+                   coverage_map& shm) {
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     if (sockfd < 0) {
         std::string errorMessage = "Could not create UDP socket: ";
@@ -235,10 +89,10 @@ int sendUdpMessage(const std::string& host, uint16_t port,
     }
     return 0;
 }
-int run_driver(std::array<char, SIZE>& shm, std::vector<Input>& inputs) {
+int run_driver(coverage_map& shm, std::vector<Input>& inputs) {
     // Define the CoAP server details.
     std::string coapServerHost = "127.0.0.1";
-    uint16_t coapServerPort = 5683;
+    uint16_t coapServerPort = server_port(5683);
 
     // Create the CoAP message.
     std::vector<uint8_t> coapMessage = createCoapMessage(inputs);
@@ -246,7 +100,8 @@ int run_driver(std::array<char, SIZE>& shm, std::vector<Input>& inputs) {
     int result =
         sendUdpMessage(coapServerHost, coapServerPort, coapMessage, shm);
     // hash here?
-    hash_cov_into_shm(shm, "data/.coverage");
+    if (!python_shm_coverage())
+        hash_cov_into_shm(shm, coverage_data_file().c_str());
 
     // Handle the result as needed
     if (result == 1) {
@@ -256,7 +111,246 @@ int run_driver(std::array<char, SIZE>& shm, std::vector<Input>& inputs) {
 
     return 0;
 }
+// Value formats of the options CoAPthon knows (coapthon/defines.py)
+enum class OptionFormat { EMPTY, OPAQUE, UINT, STRING };
+
+typedef struct {
+    uint16_t number;
+    OptionFormat format;
+    uint16_t min_len;
+    uint16_t max_len;
+} OptionSpec;
+
+static const OptionSpec option_registry[] = {
+    {1, OptionFormat::OPAQUE, 0, 8},     // If-Match
+    {3, OptionFormat::STRING, 1, 255},   // Uri-Host
+    {4, OptionFormat::OPAQUE, 1, 8},     // ETag
+    {5, OptionFormat::EMPTY, 0, 0},      // If-None-Match
+    {6, OptionFormat::UINT, 0, 3},       // Observe
+    {7, OptionFormat::UINT, 0, 2},       // Uri-Port
+    {8, OptionFormat::STRING, 0, 255},   // Location-Path
+    {11, OptionFormat::STRING, 0, 255},  // Uri-Path
+    {12, OptionFormat::UINT, 0, 2},      // Content-Format
+    {14, OptionFormat::UINT, 0, 4},      // Max-Age
+    {15, OptionFormat::STRING, 0, 255},  // Uri-Query
+    {17, OptionFormat::UINT, 0, 2},      // Accept
+    {20, OptionFormat::STRING, 0, 255},  // Location-Query
+    {23, OptionFormat::UINT, 0, 3},      // Block2
+    {27, OptionFormat::UINT, 0, 3},      // Block1
+    {35, OptionFormat::STRING, 1, 1034}, // Proxy-Uri
+    {39, OptionFormat::STRING, 1, 255},  // Proxy-Scheme
+    {60, OptionFormat::UINT, 0, 4},      // Size1
+};
+const size_t OPTION_REGISTRY_SIZE =
+    sizeof(option_registry) / sizeof(option_registry[0]);
+
+// Options per message the mutator grows to at most
+const size_t MAX_OPTIONS = 32;
+
+// Longest string value the mutator makes up, longer ones come from havoc
+// on the seeds' values
+const uint16_t MAX_MADE_UP_STRING = 16;
+
+static uint32_t below(uint32_t limit) {
+    return limit <= 1 ? 0 : rng.below(limit);
+}
+
+static const OptionSpec* find_spec(uint16_t number) {
+    for (const auto& spec : option_registry) {
+        if (spec.number == number)
+            return &spec;
+    }
+    return nullptr;
+}
+
+// Gives an option a value that fits its format, or random bytes if
+// CoAPthon does not know the option
+static void random_value(CoapOption& option) {
+    static const char alphabet[] =
+        "abcdefghijklmnopqrstuvwxyz0123456789/?=&.-_";
+    const OptionSpec* spec = find_spec(option.number);
+    uint32_t length;
+    if (!spec) {
+        length = below(9);
+    } else if (spec->format == OptionFormat::STRING) {
+        uint32_t max_len = std::min(spec->max_len, MAX_MADE_UP_STRING);
+        length = spec->min_len + below(max_len - spec->min_len + 1);
+    } else {
+        length = spec->min_len + below(spec->max_len - spec->min_len + 1);
+    }
+
+    option.value.resize(length);
+    for (auto& b : option.value) {
+        if (spec && spec->format == OptionFormat::STRING)
+            b = alphabet[below(sizeof(alphabet) - 1)];
+        else
+            b = below(256);
+    }
+}
+
+/**
+ * @brief Mutates the options of an "Options" field, see coap_message.h for
+ * its records. Options are inserted, deleted, duplicated or moved, their
+ * numbers and values changed, or given a quirk that breaks their encoding.
+ * Inserted options mostly come from CoAPthon's option registry and keep the
+ * options in order, so that most messages get past its deserializer.
+ *
+ * Options are moved around by rotating them, and deleted ones stay past the
+ * count, so that once the buffers fit, mutating does not allocate.
+*/
+static void mutate_options(std::vector<std::byte>& data) {
+    static std::vector<CoapOption> options;
+    size_t count = decode_options(data, options);
+    // Every value fits a made-up one, as rotating hands buffers around, and
+    // so do the spare options added below
+    for (auto& option : options)
+        option.value.reserve(MAX_MADE_UP_STRING);
+
+    // The option past the others, to fill and rotate into place
+    auto spare = [&]() -> CoapOption& {
+        if (options.size() == count) {
+            options.emplace_back();
+            options.back().value.reserve(MAX_MADE_UP_STRING);
+        }
+        return options[count];
+    };
+    auto move_option = [&](size_t from, size_t to) {
+        if (from < to)
+            std::rotate(options.begin() + from, options.begin() + from + 1,
+                        options.begin() + to + 1);
+        else
+            std::rotate(options.begin() + to, options.begin() + from,
+                        options.begin() + from + 1);
+    };
+
+    uint32_t use_stacking = 1 + below(4);
+    for (uint32_t i = 0; i < use_stacking; i++) {
+        // Weighted towards the well-formed changes
+        uint32_t c = below(16);
+        if (count == 0 && c >= 4)
+            c = 0;
+        switch (c) {
+            case 0:
+            case 1:
+            case 2:
+            case 3: {
+                // Insert an option, now and then one CoAPthon does not know
+                if (count >= MAX_OPTIONS)
+                    break;
+                CoapOption& option = spare();
+                if (below(16))
+                    option.number =
+                        option_registry[below(OPTION_REGISTRY_SIZE)].number;
+                else
+                    option.number = below(65536);
+                option.quirk = OptionQuirk::NONE;
+                random_value(option);
+                size_t at = 0;
+                while (at < count && options[at].number <= option.number)
+                    at++;
+                move_option(count++, at);
+                break;
+            }
+            case 4:
+            case 5: {
+                move_option(below(count), count - 1);
+                count--;
+                break;
+            }
+            case 6:
+            case 7: {
+                // Duplicate, for repeatable options and those that are not
+                if (count >= MAX_OPTIONS)
+                    break;
+                size_t from = below(count);
+                CoapOption& option = spare();
+                option.number = options[from].number;
+                option.quirk = options[from].quirk;
+                option.value.assign(options[from].value.begin(),
+                                    options[from].value.end());
+                move_option(count++, from + 1);
+                break;
+            }
+            case 8: {
+                // Move, which gives a delta going back when out of order
+                move_option(below(count), below(count));
+                break;
+            }
+            case 9:
+            case 10: {
+                // Change the delta: to 0, to another known option, which
+                // may go back, or by a little
+                size_t at = below(count);
+                switch (below(4)) {
+                    case 0:
+                        options[at].number = at ? options[at - 1].number : 0;
+                        break;
+                    case 1:
+                    case 2:
+                        options[at].number =
+                            option_registry[below(OPTION_REGISTRY_SIZE)].number;
+                        break;
+                    case 3:
+                        options[at].number += below(2) ? 1 + below(4)
+                                                       : -(1 + below(4));
+                        break;
+                }
+                break;
+            }
+            case 11:
+            case 12:
+            case 13: {
+                // New value, or a byte of the value changed
+                CoapOption& target = options[below(count)];
+                if (target.value.empty() || below(2))
+                    random_value(target);
+                else
+                    target.value[below(target.value.size())] = below(256);
+                break;
+            }
+            case 14:
+            case 15: {
+                // Break the encoding of an option, or repair it
+                CoapOption& target = options[below(count)];
+                if (target.quirk != OptionQuirk::NONE && below(2))
+                    target.quirk = OptionQuirk::NONE;
+                else
+                    target.quirk = static_cast<OptionQuirk>(
+                        1 + below(static_cast<uint8_t>(OptionQuirk::COUNT) - 1));
+                break;
+            }
+        }
+    }
+
+    encode_options(options, count, data);
+}
+
+// Fields with "mutator": "coap_options" hold options in the records of
+// coap_message.h
+bool mutate_structured(const Field& format, std::vector<std::byte>& data) {
+    if (format.mutator != "coap_options")
+        return false;
+    mutate_options(data);
+    return true;
+}
+
+// CoAPthon gets ready once it answers on its port
+ServerProbe server_probe() {
+    return {ProbeType::COAP_PING, server_port(5683)};
+}
+
 pid_t run_server() {
+    // Every worker gets its own port and coverage file. sudo drops the
+    // environment, so the coverage settings are handed over through gdb.
+    std::string port = std::to_string(server_port(5683));
+    std::string coverage_env = "set environment COVERAGE_FILE=" +
+                               coverage_data_file();
+    std::string shm_env = "set environment " COVERAGE_SHM_ENV "=";
+    std::string pythonpath_env = "set environment PYTHONPATH=";
+    if (python_shm_coverage()) {
+        shm_env += getenv(COVERAGE_SHM_ENV);
+        pythonpath_env += getenv("PYTHONPATH");
+    }
     pid_t pid = fork();
 
     if (pid == -1) {
@@ -281,6 +375,12 @@ pid_t run_server() {
             (char*)"sudo",
             (char*)"gdb",
             (char*)"-ex",
+            (char*)coverage_env.c_str(),
+            (char*)"-ex",
+            (char*)shm_env.c_str(),
+            (char*)"-ex",
+            (char*)pythonpath_env.c_str(),
+            (char*)"-ex",
             (char*)"run",
             (char*)"-ex",
             (char*)"backtrace",
@@ -290,7 +390,7 @@ pid_t run_server() {
             (char*)"-i",
             (char*)"127.0.0.1",
             (char*)"-p",
-            (char*)"5683",
+            (char*)port.c_str(),
             (char*)">",
             (char*)"/dev/null",
             (char*)"2>&1",
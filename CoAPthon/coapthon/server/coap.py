@@ -46,7 +46,13 @@ class CoAP(object):
         :param sock: if a socket has been created externally, it can be used directly
         :param cb_ignore_listen_exception: Callback function to handle exception raised during the socket listen operation
         """
-        self.cov = coverage.Coverage(branch=True, config_file=".coveragerc")
+        if os.environ.get("__FUZZ_SHM_ID"):
+            # The fuzzer reads the coverage straight from shared memory
+            import fuzz_coverage
+            root = os.path.join(os.path.dirname(__file__), "..", "..")
+            self.cov = fuzz_coverage.ShmCoverage(root)
+        else:
+            self.cov = coverage.Coverage(branch=True, config_file=".coveragerc")
         def exit_fn():
             self.cov.stop()
             self.cov.save()
@@ -157,6 +163,8 @@ class CoAP(object):
                         continue
                 raise
             try:
+                # Each request writes a data file of its own arcs only
+                self.cov.erase()
                 self.cov.start()
                 serializer = Serializer()
                 message = serializer.deserialize(data, client_address)
@@ -266,14 +274,16 @@ class CoAP(object):
             logger.debug("send_datagram - " + str(message))
             serializer = Serializer()
             message = serializer.serialize(message)
+
+            # Coverage has to be complete by the time the fuzzer gets the reply
+            self.cov.stop()
+            self.cov.save()
+
             if self.multicast:
                 self._unicast_socket.sendto(message, (host, port))
             else:
                 self._socket.sendto(message, (host, port))
 
-            self.cov.stop()
-            self.cov.save()
-
     def add_resource(self, path, resource):
         """
         Helper function to add resources to the resource directory during server initialization.
@@ -19,92 +19,10 @@
 #include <cstdlib>
 #include "../checksum.h"
 #include "../bug_checking.h"
+#include "http_request.h"
 const int bufferSize = 4096;
 char buffer[bufferSize];
-// Function to construct the CoAP message using the Input vector.
-std::string createHttpRequest(const std::vector<Input>& inputs) {
-    std::map<std::string, std::string> headers;
-    std::ostringstream body;
-    std::string method{};
-    std::string url{};
-    std::string cookie{};
-    std::string sessionID{};
-    std::string index{};
-    nlohmann::json jsonBody;
-    std::string value{};
-    std::string jsonBuilder =  R"({)";
-    bool first = true;
-    body << "{";
-    for (const auto& input : inputs) {
-        if (input.name == "method") {
-            method.reserve(input.data.size()); // Reserve space to avoid reallocation
-
-            for (std::byte b : input.data) {
-                method.push_back(static_cast<char>(b));
-            }
-        } 
-        else if(input.name == "index"){
-            index.reserve(input.data.size()); // Reserve space to avoid reallocation
-
-            for (std::byte b : input.data) {
-                index.push_back(static_cast<char>(b));
-            }
-        } else if (input.name == "url") {
-          
-            url.reserve(input.data.size()); // Reserve space to avoid reallocation
-
-            for (std::byte b : input.data) {
-                url.push_back(static_cast<char>(b));
-            }
-           
-        } else if (input.name == "Cookie") {
-            cookie.reserve(input.data.size()); // Reserve space to avoid reallocation
-
-            for (std::byte b : input.data) {
-                cookie.push_back(static_cast<char>(b));
-            }
-        } else if (input.name == "Session") {
-            sessionID.reserve(input.data.size()); // Reserve space to avoid reallocation
-
-            for (std::byte b : input.data) {
-                sessionID.push_back(static_cast<char>(b));
-            }
-        }else if (input.name == "headers") {} 
-        else {
-            value = "";
-            for (std::byte b : input.data) {
-                value.push_back(static_cast<char>(b));
-            }
-            jsonBody[input.name] = value;
-            if (!first) {
-                jsonBuilder += ", ";
-            }
-            first = false;
-            jsonBuilder += "\"" + input.name + "\": \"" + value + "\"";
-            
-        }
-    }
-    jsonBuilder += R"(})"; 
-    if(url=="/datatb/product/delete/" ||url =="/datatb/product/edit/"){
-        url += index +"/"; 
-    }
-    headers["Cookie"] = "csrftoken=" + cookie + "; sessionid="  + sessionID;
-    std::string bodyStr = body.str();
-    //std::string test =R"({"info":"beep","name":"asdasd","price":"13"})";
-    std::ostringstream request;
-    request << method << " " << url << " HTTP/1.1\r\n";
-    for (const auto& header : headers) {
-        request << header.first << ": " << header.second << "\r\n";
-    }
-        request << "Content-Type: application/json\r\n";
-        request << "Content-Length: " << jsonBuilder.size() << "\r\n\r\n";
-        request << jsonBuilder;
-
-   
-
-    return request.str();
-}
-int sendTcpMessageWithTimeout(const std::string& host, uint16_t port, const std::vector<uint8_t>& message) {
+int sendTcpMessageWithTimeout(const std::string& host, uint16_t port, const std::string& message) {
     // Create a TCP socket
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {
@@ -183,16 +101,12 @@ int run_driver(std::vector<Input>& inputs) {
     std::string coapServerHost = "127.0.0.1";
     uint16_t coapServerPort = 8000;
 
-    std::string strMsg = createHttpRequest(inputs);
+    // Reused between inputs, like the buffers of the mutators
+    static std::string strMsg;
+    createHttpRequest(inputs, strMsg);
     std::cout << strMsg << std::endl;
-    
-    std::vector<uint8_t> httpMessage;
-    httpMessage.reserve(strMsg.size());
-    for (char c : strMsg) {
-        httpMessage.push_back(static_cast<uint8_t>(c));
-    }
     std::cout << strMsg << std::endl;
-    int result = sendTcpMessageWithTimeout(coapServerHost, coapServerPort, httpMessage);
+    int result = sendTcpMessageWithTimeout(coapServerHost, coapServerPort, strMsg);
 
 
     if (result == 1) {
@@ -1,14 +1,15 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
-#include <sqlite3.h>
 #include <sys/select.h>  // For select() and FD_SET
 #include <sys/socket.h>  // For socket, sendto, and close
 #include <unistd.h>      // For close
+#include <algorithm>
 #include <array>
 #include <cerrno>   // For errno
 #include <chrono>   // For system_clock
 #include <thread>   // for sleeping for milliseconds
 #include <cstddef>  // For std::byte
+#include <cstdlib>
 #include <cstdint>  // For uint8_t
 #include <cstring>  // For memset
 #include <cstring>  // For strerror
@@ -17,142 +18,423 @@
 #include <string>
 #include <vector>
 #include <signal.h>
-#include "../checksum.h"
+#include "../coverage_db.h"
 #include "../driver.h"
+#include "../rng.h"
+#include "http_request.h"
 
 const int bufferSize = 4096;
 char buffer[bufferSize];
 
-int hash_cov_into_shm(std::array<char, SIZE>& shm, const char* filename) {
-    sqlite3* db;
-    char* zErrMsg = 0;
-    int rc;
-    rc = sqlite3_open(filename, &db);
-    if (rc) {
-        fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-        return (0);
-    } else {
-        // fprintf(stderr, "Opened database successfully\n");
+// Parts of requests the grammar mutator picks from, besides the tokens of
+// the field. Targets are the routes of core/urls.py and django_dyn_dt.
+static const char* const http_methods[] = {
+    "GET", "POST", "PUT", "PATCH", "DELETE", "HEAD", "OPTIONS", "TRACE", "get",
+    "P0ST"};
+static const char* const http_targets[] = {
+    "/", "/tables/", "/datatb/product/", "/datatb/product/add/",
+    "/datatb/product/edit/1/", "/datatb/product/delete/1/",
+    "/datatb/product/export/", "/api/product/", "/api/product/1/",
+    "/login/jwt/", "/admin/"};
+static const char* const http_versions[] = {"HTTP/1.1", "HTTP/1.0",
+                                            "HTTP/2.0", "HTTP/1.", "http/1.1"};
+static const char* const content_types[] = {
+    "application/json", "application/json; charset=utf-8",
+    "application/x-www-form-urlencoded",
+    "multipart/form-data; boundary=fuzzboundary", "text/plain",
+    "application/xml", ""};
+static const HttpHeader known_headers[] = {
+    {"Accept", "*/*"},
+    {"Accept", "application/json"},
+    {"Host", "127.0.0.1"},
+    {"User-Agent", "fuzz_main"},
+    {"X-Requested-With", "XMLHttpRequest"},
+    {"X-CSRFToken", ""},
+    {"Referer", "http://127.0.0.1/datatb/product/"},
+    {"Origin", "http://127.0.0.1"},
+    {"Authorization", "Token "},
+    {"Accept-Encoding", "gzip, deflate"},
+    {"Connection", "close"}};
+static const char* const cookie_names[] = {"csrftoken", "sessionid",
+                                           "messages", "django_language"};
+static const char* const json_keys[] = {"name", "info", "price", "id", "pk",
+                                        "search", "page", "export"};
+static const char* const interesting_numbers[] = {
+    "0", "-1", "1", "255", "65535", "2147483647", "-2147483648",
+    "4294967295", "-4294967295", "9223372036854775807", "1e308", "-0", "0.5",
+    "1e-7"};
+static const char* const interesting_strings[] = {
+    "", "0", "-1", "null", "true", "\\", "\"", "{}", "[]", "'", "%", "%s%n",
+    "<script>", "' OR 1=1 --", "../", "\xc3\xa9", "\t", "\r\n"};
+
+// Requests the mutator writes back are cut off at this length
+const size_t MAX_REQUEST = 65536;
+
+template <typename T, size_t N>
+static const T& pick(const T (&items)[N]) {
+    return items[rng.below(N)];
+}
+
+static uint32_t below(uint32_t limit) {
+    return limit <= 1 ? 0 : rng.below(limit);
+}
+
+// A token of the field's dictionary, or one of the given strings
+template <size_t N>
+static HttpString pick_string(const TokenTable& tokens,
+                              const char* const (&items)[N]) {
+    if (!tokens.empty() && below(4) == 0) {
+        uint32_t i = below(tokens.size());
+        return HttpString(reinterpret_cast<const char*>(tokens.token(i)),
+                          tokens.length(i));
     }
+    return pick(items);
+}
+
+static HttpString random_token(size_t length) {
+    static const char alphabet[] =
+        "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    HttpString token(length, ' ');
+    for (auto& c : token)
+        c = alphabet[below(sizeof(alphabet) - 1)];
+    return token;
+}
 
-    const char* sql = "SELECT * from arc";
-    sqlite3_stmt* stmt;
-    sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    int ncols = sqlite3_column_count(stmt);
-    int res;
-    do {
-        res = sqlite3_step(stmt);
-        uint16_t crc = 0;
-        for (int i = 0; i < ncols; i++) {
-            int item = sqlite3_column_int(stmt, i);
-            crc = update_crc_16(crc, item);
+static void random_json(JsonNode& node, const TokenTable& tokens, int depth) {
+    node.children.clear();
+    node.value.clear();
+    // Containers get rarer with depth, so that trees stay small
+    uint32_t kinds = depth < 3 ? 6 : 4;
+    switch (below(kinds)) {
+        case 0:
+            node.kind = JsonKind::NUL;
+            break;
+        case 1:
+            node.kind = JsonKind::BOOL;
+            node.value = below(2) ? "true" : "false";
+            break;
+        case 2:
+            node.kind = JsonKind::NUMBER;
+            node.value = pick(interesting_numbers);
+            break;
+        case 3:
+            node.kind = JsonKind::STRING;
+            node.value = pick_string(tokens, interesting_strings);
+            break;
+        case 4:
+        case 5: {
+            node.kind = below(2) ? JsonKind::ARRAY : JsonKind::OBJECT;
+            node.children.resize(below(4));
+            for (auto& child : node.children) {
+                if (node.kind == JsonKind::OBJECT)
+                    child.key = pick_string(tokens, json_keys);
+                random_json(child, tokens, depth + 1);
+            }
+            break;
         }
-        shm[crc]++;
-    } while (res == SQLITE_ROW);
-    sqlite3_finalize(stmt);
-    int res1 = sqlite3_close(db);
-    return 0;
+    }
 }
 
+static void collect_nodes(JsonNode& node, std::vector<JsonNode*>& nodes) {
+    nodes.push_back(&node);
+    for (auto& child : node.children)
+        collect_nodes(child, nodes);
+}
 
-std::string createHttpRequest(const std::vector<Input>& inputs) {
-    std::map<std::string, std::string> headers;
-    std::ostringstream body;
-    std::string method{};
-    std::string url{};
-    std::string cookie{};
-    std::string sessionID{};
-    std::string index{};
-    nlohmann::json jsonBody;
-    std::string price{};
-    std::string value{};
-    std::string jsonBuilder =  R"({)";
-    bool first = true;
-    body << "{";
-    for (const auto& input : inputs) {
-        if (input.name == "method") {
-            method.reserve(input.data.size()); // Reserve space to avoid reallocation
-
-            for (std::byte b : input.data) {
-                method.push_back(static_cast<char>(b));
+// Changes a value to another type, keeping what can be kept of it
+static void confuse_type(JsonNode& node, const TokenTable& tokens) {
+    switch (below(5)) {
+        case 0: {
+            // Scalar to string and back
+            if (node.kind == JsonKind::STRING) {
+                bool numeric = !node.value.empty() &&
+                               node.value.find_first_not_of("0123456789-") ==
+                                   std::string::npos;
+                node.kind = JsonKind::NUMBER;
+                if (!numeric)
+                    node.value = pick(interesting_numbers);
+            } else if (node.kind == JsonKind::ARRAY ||
+                       node.kind == JsonKind::OBJECT) {
+                static std::string text;
+                text.clear();
+                serialize_json(node, text);
+                node.children.clear();
+                node.kind = JsonKind::STRING;
+                node.value = text;
+            } else {
+                if (node.kind == JsonKind::NUL)
+                    node.value = "null";
+                node.kind = JsonKind::STRING;
             }
-        } 
-        else if(input.name == "index"){
-            index.reserve(input.data.size()); // Reserve space to avoid reallocation
-
-            for (std::byte b : input.data) {
-                index.push_back(static_cast<char>(b));
+            break;
+        }
+        case 1: {
+            // Wrap into an array or an object
+            JsonNode inner = node;
+            inner.key.clear();
+            node.kind = below(2) ? JsonKind::ARRAY : JsonKind::OBJECT;
+            node.value.clear();
+            node.children.assign(1, inner);
+            if (node.kind == JsonKind::OBJECT)
+                node.children[0].key = pick_string(tokens, json_keys);
+            break;
+        }
+        case 2: {
+            // Array to object and back, members get or lose their keys
+            if (node.kind == JsonKind::ARRAY) {
+                node.kind = JsonKind::OBJECT;
+                for (auto& child : node.children)
+                    child.key = pick_string(tokens, json_keys);
+            } else if (node.kind == JsonKind::OBJECT) {
+                node.kind = JsonKind::ARRAY;
+                for (auto& child : node.children)
+                    child.key.clear();
             }
-        } else if (input.name == "url") {
-          
-            url.reserve(input.data.size()); // Reserve space to avoid reallocation
+            break;
+        }
+        case 3:
+            node.kind = JsonKind::BOOL;
+            node.children.clear();
+            node.value = below(2) ? "true" : "false";
+            break;
+        case 4:
+            node.kind = JsonKind::NUL;
+            node.children.clear();
+            node.value.clear();
+            break;
+    }
+}
 
-            for (std::byte b : input.data) {
-                url.push_back(static_cast<char>(b));
-            }
-           
-        } else if (input.name == "Cookie") {
-            cookie.reserve(input.data.size()); // Reserve space to avoid reallocation
+static void mutate_string(HttpString& s, const TokenTable& tokens) {
+    switch (below(6)) {
+        case 0:
+            s = pick_string(tokens, interesting_strings);
+            break;
+        case 1:
+            // Doubling gets to long values in a few steps
+            if (s.size() < MAX_REQUEST / 4)
+                s += s.empty() ? "A" : s;
+            break;
+        case 2:
+            s.insert(below(s.size() + 1), pick_string(tokens, interesting_strings));
+            break;
+        case 3:
+            if (!s.empty())
+                s.erase(below(s.size()), 1 + below(s.size()));
+            break;
+        case 4:
+            if (!s.empty())
+                s[below(s.size())] = below(256);
+            break;
+        case 5:
+            s = random_token(below(33));
+            break;
+    }
+}
 
-            for (std::byte b : input.data) {
-                cookie.push_back(static_cast<char>(b));
+/**
+ * @brief Grammar mutator of a whole request, parsed from the field and
+ * written back. Mutates the request line, headers, cookies and content
+ * type, and the JSON body as a tree: values replaced by new subtrees or
+ * spliced from elsewhere in the body, members duplicated, inserted or
+ * deleted, types confused, and strings and numbers changed.
+*/
+static void mutate_request(const Field& format, std::vector<std::byte>& data) {
+    static HttpRequest request;
+    static std::vector<JsonNode*> nodes;
+    static std::string text;
+    const TokenTable& tokens = format.tokens;
+    parse_request(data, request);
+
+    uint32_t use_stacking = 1 + below(4);
+    for (uint32_t i = 0; i < use_stacking; i++) {
+        nodes.clear();
+        collect_nodes(request.body, nodes);
+        JsonNode& node = *nodes[below(nodes.size())];
+
+        // Weighted towards the body, where the views read their input
+        switch (below(20)) {
+            case 0:
+                request.method = pick(http_methods);
+                break;
+            case 1: {
+                switch (below(3)) {
+                    case 0:
+                        request.target = pick_string(tokens, http_targets);
+                        break;
+                    case 1:
+                        request.target += pick(interesting_numbers);
+                        request.target += "/";
+                        break;
+                    case 2:
+                        request.target += request.target.find('?') ==
+                                                  std::string::npos
+                                              ? "?"
+                                              : "&";
+                        request.target += pick_string(tokens, json_keys);
+                        request.target += "=";
+                        request.target += pick(interesting_numbers);
+                        break;
+                }
+                break;
             }
-        } else if (input.name == "Session") {
-            sessionID.reserve(input.data.size()); // Reserve space to avoid reallocation
-
-            for (std::byte b : input.data) {
-                sessionID.push_back(static_cast<char>(b));
+            case 2:
+                request.version = pick(http_versions);
+                break;
+            case 3: {
+                // Insert, delete, duplicate or change a header
+                auto& headers = request.headers;
+                uint32_t c = headers.empty() ? 0 : below(4);
+                if (c == 0) {
+                    HttpHeader header = pick(known_headers);
+                    if (header.value.empty() || below(2))
+                        header.value += random_token(32);
+                    headers.insert(headers.begin() + below(headers.size() + 1),
+                                   header);
+                } else if (c == 1) {
+                    headers.erase(headers.begin() + below(headers.size()));
+                } else if (c == 2) {
+                    size_t at = below(headers.size());
+                    headers.insert(headers.begin() + at, headers[at]);
+                } else {
+                    mutate_string(headers[below(headers.size())].value, tokens);
+                }
+                break;
             }
-        }else if (input.name == "headers") {} 
-        else if (input.name == "price") {
-            int64_t priceNum = 0;
-            for (std::byte b : input.data) {
-                priceNum = (priceNum << 8) + static_cast<int64_t>(b);
+            case 4: {
+                // Same for cookies, whose values are mostly tokens of the
+                // length Django uses
+                auto& cookies = request.cookies;
+                uint32_t c = cookies.empty() ? 0 : below(4);
+                if (c == 0) {
+                    cookies.push_back({pick(cookie_names), random_token(32)});
+                } else if (c == 1) {
+                    cookies.erase(cookies.begin() + below(cookies.size()));
+                } else if (c == 2) {
+                    size_t at = below(cookies.size());
+                    cookies.insert(cookies.begin() + at, cookies[at]);
+                } else if (below(2)) {
+                    cookies[below(cookies.size())].value = random_token(32);
+                } else {
+                    mutate_string(cookies[below(cookies.size())].value, tokens);
+                }
+                break;
             }
-            price = std::to_string(priceNum);
-        }
-        else {
-            value = "";
-            for (std::byte b : input.data) {
-                value.push_back(static_cast<char>(b));
+            case 5:
+                request.content_type = pick(content_types);
+                break;
+            case 6:
+            case 7:
+                // Subtree replace
+                random_json(node, tokens, 0);
+                break;
+            case 8: {
+                // Splice a subtree of the body over another one
+                JsonNode copy = *nodes[below(nodes.size())];
+                copy.key = node.key;
+                node = copy;
+                break;
+            }
+            case 9:
+            case 10: {
+                // Duplicate a member, Django keeps the last one
+                if (node.kind != JsonKind::OBJECT || node.children.empty())
+                    break;
+                JsonNode copy = node.children[below(node.children.size())];
+                if (below(2))
+                    random_json(copy, tokens, 1);
+                node.children.insert(
+                    node.children.begin() + below(node.children.size() + 1),
+                    copy);
+                break;
             }
-            jsonBody[input.name] = value;
-            if (!first) {
-                jsonBuilder += ", ";
+            case 11: {
+                // Insert a member or item
+                if (node.kind != JsonKind::OBJECT &&
+                    node.kind != JsonKind::ARRAY)
+                    break;
+                JsonNode child;
+                if (node.kind == JsonKind::OBJECT)
+                    child.key = pick_string(tokens, json_keys);
+                random_json(child, tokens, 1);
+                node.children.insert(
+                    node.children.begin() + below(node.children.size() + 1),
+                    child);
+                break;
             }
-            first = false;
-            jsonBuilder += "\"" + input.name + "\": \"" + value + "\"";
-            
+            case 12: {
+                if (node.children.empty())
+                    break;
+                node.children.erase(node.children.begin() +
+                                    below(node.children.size()));
+                break;
+            }
+            case 13:
+            case 14:
+                confuse_type(node, tokens);
+                break;
+            case 15:
+            case 16:
+            case 17: {
+                // Change a scalar value
+                if (node.kind == JsonKind::STRING || node.kind == JsonKind::RAW) {
+                    mutate_string(node.value, tokens);
+                } else if (node.kind == JsonKind::NUMBER) {
+                    if (below(2)) {
+                        node.value = pick(interesting_numbers);
+                    } else {
+                        long long n = strtoll(node.value.c_str(), nullptr, 10);
+                        n += below(2) ? 1 + below(35) : -(1 + (long long)below(35));
+                        char number[24];
+                        snprintf(number, sizeof(number), "%lld", n);
+                        node.value = number;
+                    }
+                } else if (node.kind == JsonKind::OBJECT &&
+                           !node.children.empty()) {
+                    mutate_string(
+                        node.children[below(node.children.size())].key, tokens);
+                }
+                break;
+            }
+            case 18: {
+                // Break the JSON syntax by cutting the serialized body
+                text.clear();
+                serialize_json(request.body, text);
+                if (text.size() > 1)
+                    text.resize(1 + below(text.size() - 1));
+                request.body.kind = JsonKind::RAW;
+                request.body.children.clear();
+                request.body.value = text;
+                break;
+            }
+            case 19:
+                // Back to a fresh JSON object, for bodies broken before
+                if (request.body.kind == JsonKind::RAW) {
+                    random_json(request.body, tokens, 0);
+                    if (request.body.kind != JsonKind::OBJECT)
+                        confuse_type(request.body, tokens);
+                }
+                break;
         }
     }
-    jsonBody["price"] = price;
-    if (!first) {
-        jsonBuilder += ", ";
-    }
-    first = false;
-    jsonBuilder += "\"price\": \"" + price + "\"";
-    jsonBuilder += R"(})"; 
-    if(url=="/datatb/product/delete/" ||url =="/datatb/product/edit/"){
-        url += index +"/"; 
-    }
-    headers["Cookie"] = "csrftoken=" + cookie + "; sessionid="  + sessionID;
-    std::string bodyStr = body.str();
-    //std::string test =R"({"info":"beep","name":"asdasd","price":"13"})";
-    std::ostringstream request;
-    request << method << " " << url << " HTTP/1.1\r\n";
-    for (const auto& header : headers) {
-        request << header.first << ": " << header.second << "\r\n";
-    }
-        request << "Content-Type: application/json\r\n";
-        request << "Content-Length: " << jsonBuilder.size() << "\r\n\r\n";
-        request << jsonBuilder;
 
-   
+    serialize_request(request, text);
+    if (text.size() <= std::min<size_t>(format.maxLen, MAX_REQUEST)) {
+        data.resize(text.size());
+        memcpy(data.data(), text.data(), text.size());
+    }
+}
 
-    return request.str();
+// Fields with "mutator": "http_request" hold a whole request, see
+// http_request.h
+bool mutate_structured(const Field& format, std::vector<std::byte>& data) {
+    if (format.mutator != "http_request")
+        return false;
+    mutate_request(format, data);
+    return true;
 }
 
-int sendTcpMessageWithTimeout(const std::string& host, uint16_t port, const std::vector<uint8_t>& message) {
+int sendTcpMessageWithTimeout(const std::string& host, uint16_t port, const std::string& message) {
     // Create a TCP socket
     int sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {
@@ -246,21 +528,18 @@ int sendTcpMessageWithTimeout(const std::string& host, uint16_t port, const std:
     close(sockfd);
     return 0; 
 }
-int run_driver(std::array<char, SIZE>& shm, std::vector<Input>& inputs) {
+int run_driver(coverage_map& shm, std::vector<Input>& inputs) {
     std::string coapServerHost = "127.0.0.1";
-    uint16_t coapServerPort = 8000;
+    uint16_t coapServerPort = server_port(8000);
 
-    std::string strMsg = createHttpRequest(inputs);
+    // Reused between inputs, like the buffers of the mutators
+    static std::string strMsg;
+    createHttpRequest(inputs, strMsg);
     std::cout << strMsg << std::endl;
-    
-    std::vector<uint8_t> httpMessage;
-    httpMessage.reserve(strMsg.size());
-    for (char c : strMsg) {
-        httpMessage.push_back(static_cast<uint8_t>(c));
-    }
-    int result = sendTcpMessageWithTimeout(coapServerHost, coapServerPort, httpMessage);
+    int result = sendTcpMessageWithTimeout(coapServerHost, coapServerPort, strMsg);
 
-    hash_cov_into_shm(shm, "data/.coverage");
+    if (!python_shm_coverage())
+        hash_cov_into_shm(shm, coverage_data_file().c_str());
 
     if (result == 1) {
         std::cout << "Timeout occurred or no response received." << std::endl;
@@ -270,20 +549,15 @@ int run_driver(std::array<char, SIZE>& shm, std::vector<Input>& inputs) {
     return 0;
 }
 
-pid_t pid;
-
-void signalHandler(int signal) {
-    std::cout << "Terminating pid: " << pid << "\n";
-    killpg(getpgid(pid), SIGINT);
-    exit(1);
+ServerProbe server_probe() {
+    return {ProbeType::TCP_CONNECT, server_port(8000)};
 }
 
 pid_t run_server() {
     std::string managePyPath= "DjangoWebApplication/manage.py";
     std::string ipAddress = "127.0.0.1";
-    std::string port = "8000";
-    pid = fork();
-    // pid_t pid = 0;
+    std::string port = std::to_string(server_port(8000));
+    pid_t pid = fork();
 
     if (pid == -1) {
         std::cerr << "Failed to fork" << std::endl;
@@ -304,6 +578,9 @@ pid_t run_server() {
             _exit(EXIT_FAILURE);
         }
 
+        // Keep the coverage of this worker's server apart from the others
+        setenv("COVERAGE_FILE", coverage_data_file().c_str(), 1);
+
         // Run Django server
         char* args[] = {
             (char*)"python3",
@@ -318,13 +595,7 @@ pid_t run_server() {
         _exit(EXIT_FAILURE); // Use _exit in child after fork
     }
 
-    // Kill child process if main is interrupted
-    signal(SIGINT, signalHandler);
-    signal(SIGKILL, signalHandler);
-    signal(SIGTERM, signalHandler);
-    signal(SIGQUIT, signalHandler);
-
-
-    // Parent process
+    // Parent process. Its process group is stopped by stop_all_servers(), also
+    // when the fuzzer is interrupted
     return pid; // Return the child process ID
 }
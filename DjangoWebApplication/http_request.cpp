@@ -0,0 +1,424 @@
+#include "http_request.h"
+#include <strings.h>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Blocks of up to four times the longest request are pooled, which covers
+// the values the mutator doubles
+static std::pmr::unsynchronized_pool_resource request_pool{
+    std::pmr::pool_options{0, 1 << 18}};
+// Set before main(), so before the first request is built
+static std::pmr::memory_resource* const heap_resource =
+    std::pmr::set_default_resource(&request_pool);
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void skip_space(const char*& p, const char* end) {
+    while (p < end && is_space(*p))
+        p++;
+}
+
+static bool same_name(const HttpString& a, const char* b) {
+    return strcasecmp(a.c_str(), b) == 0;
+}
+
+static void trim(HttpString& s) {
+    size_t from = 0;
+    while (from < s.size() && is_space(s[from]))
+        from++;
+    size_t to = s.size();
+    while (to > from && is_space(s[to - 1]))
+        to--;
+    s.assign(s, from, to - from);
+}
+
+static void put_utf8(uint32_t cp, HttpString& out) {
+    if (cp < 0x80) {
+        out.push_back(cp);
+    } else if (cp < 0x800) {
+        out.push_back(0xC0 | cp >> 6);
+        out.push_back(0x80 | (cp & 0x3F));
+    } else {
+        out.push_back(0xE0 | cp >> 12);
+        out.push_back(0x80 | (cp >> 6 & 0x3F));
+        out.push_back(0x80 | (cp & 0x3F));
+    }
+}
+
+// Reads a JSON string, p is at its opening quote
+static bool parse_string(const char*& p, const char* end, HttpString& out) {
+    out.clear();
+    p++;
+    while (p < end && *p != '"') {
+        if (*p != '\\') {
+            out.push_back(*p++);
+            continue;
+        }
+        if (++p == end)
+            return false;
+        switch (*p++) {
+            case '"': out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '/': out.push_back('/'); break;
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u': {
+                if (end - p < 4)
+                    return false;
+                char hex[5] = {p[0], p[1], p[2], p[3], 0};
+                char* hex_end;
+                uint32_t cp = strtoul(hex, &hex_end, 16);
+                if (hex_end != hex + 4)
+                    return false;
+                put_utf8(cp, out);
+                p += 4;
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    if (p == end)
+        return false;
+    p++;
+    return true;
+}
+
+static bool parse_value(const char*& p, const char* end, JsonNode& node,
+                        int depth) {
+    skip_space(p, end);
+    if (p == end || depth > MAX_JSON_DEPTH)
+        return false;
+
+    node.children.clear();
+    node.value.clear();
+    switch (*p) {
+        case '{':
+        case '[': {
+            const bool object = *p == '{';
+            const char close = object ? '}' : ']';
+            node.kind = object ? JsonKind::OBJECT : JsonKind::ARRAY;
+            p++;
+            skip_space(p, end);
+            if (p < end && *p == close) {
+                p++;
+                return true;
+            }
+            while (true) {
+                node.children.emplace_back();
+                JsonNode& child = node.children.back();
+                if (object) {
+                    skip_space(p, end);
+                    if (p == end || *p != '"' || !parse_string(p, end, child.key))
+                        return false;
+                    skip_space(p, end);
+                    if (p == end || *p++ != ':')
+                        return false;
+                }
+                if (!parse_value(p, end, child, depth + 1))
+                    return false;
+                skip_space(p, end);
+                if (p == end)
+                    return false;
+                if (*p == close) {
+                    p++;
+                    return true;
+                }
+                if (*p++ != ',')
+                    return false;
+            }
+        }
+        case '"':
+            node.kind = JsonKind::STRING;
+            return parse_string(p, end, node.value);
+        default: {
+            // Literals are kept as written, numbers included
+            const char* start = p;
+            while (p < end && !is_space(*p) && !strchr(",:]}", *p))
+                p++;
+            node.value.assign(start, p);
+            if (node.value == "null") {
+                node.kind = JsonKind::NUL;
+            } else if (node.value == "true" || node.value == "false") {
+                node.kind = JsonKind::BOOL;
+            } else if (node.value.find_first_not_of("0123456789+-.eE") ==
+                           std::string::npos &&
+                       !node.value.empty()) {
+                node.kind = JsonKind::NUMBER;
+            } else {
+                return false;
+            }
+            return true;
+        }
+    }
+}
+
+static void parse_body(const char* p, const char* end, JsonNode& body) {
+    const char* start = p;
+    body.key.clear();
+    if (parse_value(p, end, body, 0)) {
+        skip_space(p, end);
+        if (p == end)
+            return;
+    }
+    body.kind = JsonKind::RAW;
+    body.children.clear();
+    body.value.assign(start, end);
+}
+
+void parse_request(const std::vector<std::byte>& data, HttpRequest& request) {
+    const char* p = reinterpret_cast<const char*>(data.data());
+    const char* end = p + data.size();
+
+    // Lines end at LF, with or without CR. Returns false after the last one.
+    static HttpString line;
+    auto next_line = [&]() {
+        if (p == end)
+            return false;
+        const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+        const char* line_end = eol ? eol : end;
+        line.assign(p, line_end);
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        p = eol ? eol + 1 : end;
+        return true;
+    };
+
+    request.method = "GET";
+    request.target = "/";
+    request.version = "HTTP/1.1";
+    request.headers.clear();
+    request.cookies.clear();
+    request.content_type.clear();
+
+    if (next_line()) {
+        size_t first = line.find(' ');
+        size_t second =
+            first == std::string::npos ? first : line.find(' ', first + 1);
+        if (first != 0)
+            request.method.assign(line, 0, first);
+        if (first != std::string::npos)
+            request.target.assign(line, first + 1, second - first - 1);
+        if (second != std::string::npos)
+            request.version.assign(line, second + 1, std::string::npos);
+    }
+
+    while (next_line() && !line.empty()) {
+        size_t colon = line.find(':');
+        if (colon == std::string::npos || colon == 0)
+            continue;
+        HttpHeader header{line.substr(0, colon), line.substr(colon + 1)};
+        trim(header.name);
+        trim(header.value);
+
+        if (same_name(header.name, "Cookie")) {
+            size_t from = 0;
+            while (from <= header.value.size()) {
+                size_t to = header.value.find(';', from);
+                if (to == std::string::npos)
+                    to = header.value.size();
+                HttpString cookie = header.value.substr(from, to - from);
+                trim(cookie);
+                if (!cookie.empty()) {
+                    size_t eq = cookie.find('=');
+                    if (eq == std::string::npos)
+                        request.cookies.push_back({cookie, ""});
+                    else
+                        request.cookies.push_back(
+                            {cookie.substr(0, eq), cookie.substr(eq + 1)});
+                }
+                from = to + 1;
+            }
+        } else if (same_name(header.name, "Content-Type")) {
+            request.content_type = header.value;
+        } else if (!same_name(header.name, "Content-Length") &&
+                   !same_name(header.name, "Transfer-Encoding")) {
+            // The length is written from the body, a wrong one would make
+            // the server wait for bytes that never come
+            request.headers.push_back(header);
+        }
+    }
+
+    parse_body(p, end, request.body);
+}
+
+void serialize_json(const JsonNode& node, std::string& out) {
+    auto put_string = [&](const HttpString& s) {
+        static const char hex[] = "0123456789abcdef";
+        out.push_back('"');
+        for (unsigned char c : s) {
+            if (c == '"' || c == '\\') {
+                out.push_back('\\');
+                out.push_back(c);
+            } else if (c < 0x20) {
+                out += "\\u00";
+                out.push_back(hex[c >> 4]);
+                out.push_back(hex[c & 0xF]);
+            } else {
+                out.push_back(c);
+            }
+        }
+        out.push_back('"');
+    };
+
+    switch (node.kind) {
+        case JsonKind::NUL:
+            out += "null";
+            break;
+        case JsonKind::BOOL:
+        case JsonKind::NUMBER:
+        case JsonKind::RAW:
+            out += node.value;
+            break;
+        case JsonKind::STRING:
+            put_string(node.value);
+            break;
+        case JsonKind::ARRAY:
+        case JsonKind::OBJECT: {
+            const bool object = node.kind == JsonKind::OBJECT;
+            out.push_back(object ? '{' : '[');
+            for (size_t i = 0; i < node.children.size(); i++) {
+                if (i)
+                    out += ", ";
+                if (object) {
+                    put_string(node.children[i].key);
+                    out += ": ";
+                }
+                serialize_json(node.children[i], out);
+            }
+            out.push_back(object ? '}' : ']');
+            break;
+        }
+    }
+}
+
+// Form fields take strings as they are and other values as JSON
+static void form_value(const JsonNode& node, std::string& out) {
+    if (node.kind == JsonKind::STRING)
+        out += node.value;
+    else
+        serialize_json(node, out);
+}
+
+static void url_encode(std::string_view s, std::string& out) {
+    static const char hex[] = "0123456789ABCDEF";
+    for (unsigned char c : s) {
+        if (isalnum(c) || strchr("-._~", c)) {
+            out.push_back(c);
+        } else {
+            out.push_back('%');
+            out.push_back(hex[c >> 4]);
+            out.push_back(hex[c & 0xF]);
+        }
+    }
+}
+
+static void serialize_body(const HttpRequest& request, std::string& out) {
+    const JsonNode& body = request.body;
+    const HttpString& type = request.content_type;
+
+    if (body.kind == JsonKind::OBJECT &&
+        type.find("application/x-www-form-urlencoded") != std::string::npos) {
+        static std::string value;
+        for (size_t i = 0; i < body.children.size(); i++) {
+            if (i)
+                out.push_back('&');
+            url_encode(body.children[i].key, out);
+            out.push_back('=');
+            value.clear();
+            form_value(body.children[i], value);
+            url_encode(value, out);
+        }
+    } else if (body.kind == JsonKind::OBJECT &&
+               type.find("multipart/form-data") != std::string::npos) {
+        size_t at = type.find("boundary=");
+        std::string_view boundary =
+            at == std::string::npos
+                ? std::string_view("fuzzboundary")
+                : std::string_view(type).substr(at + strlen("boundary="));
+        for (const auto& member : body.children) {
+            out += "--";
+            out += boundary;
+            out += "\r\nContent-Disposition: form-data; name=\"";
+            out += member.key;
+            out += "\"\r\n\r\n";
+            form_value(member, out);
+            out += "\r\n";
+        }
+        out += "--";
+        out += boundary;
+        out += "--\r\n";
+    } else {
+        serialize_json(body, out);
+    }
+}
+
+// Line breaks in the request line or headers would start new headers
+static void put_line_part(std::string_view s, std::string& out) {
+    for (char c : s) {
+        if (c != '\r' && c != '\n')
+            out.push_back(c);
+    }
+}
+
+void serialize_request(const HttpRequest& request, std::string& out) {
+    static std::string body;
+    body.clear();
+    serialize_body(request, body);
+
+    out.clear();
+    put_line_part(request.method, out);
+    out.push_back(' ');
+    put_line_part(request.target, out);
+    out.push_back(' ');
+    put_line_part(request.version, out);
+    out += "\r\n";
+
+    for (const auto& header : request.headers) {
+        put_line_part(header.name, out);
+        out += ": ";
+        put_line_part(header.value, out);
+        out += "\r\n";
+    }
+    if (!request.cookies.empty()) {
+        out += "Cookie: ";
+        for (size_t i = 0; i < request.cookies.size(); i++) {
+            if (i)
+                out += "; ";
+            put_line_part(request.cookies[i].name, out);
+            out.push_back('=');
+            put_line_part(request.cookies[i].value, out);
+        }
+        out += "\r\n";
+    }
+    if (!request.content_type.empty()) {
+        out += "Content-Type: ";
+        put_line_part(request.content_type, out);
+        out += "\r\n";
+    }
+    out += "Content-Length: ";
+    out += std::to_string(body.size());
+    out += "\r\n\r\n";
+    out += body;
+}
+
+void createHttpRequest(const std::vector<Input>& inputs, std::string& out) {
+    static HttpRequest request;
+    static const std::vector<std::byte> empty;
+
+    const std::vector<std::byte>* data = &empty;
+    for (const auto& input : inputs) {
+        if (input.name == "request")
+            data = &input.data;
+    }
+    parse_request(*data, request);
+    serialize_request(request, out);
+}
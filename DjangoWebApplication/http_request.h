@@ -0,0 +1,74 @@
+#pragma once
+#include <cstdint>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../inputs.h"
+
+// Requests are parsed, mutated and torn down for every mutation and every
+// run. Their strings and nodes come from a pool that keeps the memory given
+// back, set as the default memory resource by http_request.cpp, so that once
+// it has grown to fit the requests neither allocates.
+typedef std::pmr::string HttpString;
+
+enum class JsonKind : uint8_t { NUL, BOOL, NUMBER, STRING, ARRAY, OBJECT, RAW };
+
+/**
+ * @brief Node of a JSON body. Unlike nlohmann::json, objects keep their
+ * members in order and may repeat keys, and a body that is no JSON at all
+ * is kept as a RAW node with its text.
+*/
+struct JsonNode {
+    JsonKind kind = JsonKind::NUL;
+    HttpString key;    // Member name, if the parent is an object
+    HttpString value;  // Literal of booleans and numbers, text of the rest
+    std::pmr::vector<JsonNode> children;
+};
+
+typedef struct {
+    HttpString name;
+    HttpString value;
+} HttpHeader;
+
+/**
+ * @brief HTTP request as the grammar mutator sees it. Cookie, Content-Type
+ * and Content-Length are not among the headers, the first two are kept
+ * apart and the length is always that of the body.
+*/
+typedef struct {
+    HttpString method;
+    HttpString target;
+    HttpString version;
+    std::pmr::vector<HttpHeader> headers;
+    std::pmr::vector<HttpHeader> cookies;
+    HttpString content_type;
+    JsonNode body;
+} HttpRequest;
+
+// Maximum nesting of JSON bodies, deeper values are kept as RAW text
+const int MAX_JSON_DEPTH = 16;
+
+/**
+ * @brief Reads a request leniently: missing parts get defaults, lines that
+ * are no header are dropped and a body that does not parse as JSON is kept
+ * as RAW text. Any bytes give a request, so byte level mutations of the
+ * field stay usable.
+*/
+void parse_request(const std::vector<std::byte>& data, HttpRequest& request);
+
+/**
+ * @brief Writes a request into a reused buffer, with its body encoded by
+ * its content type: form fields for url encoded and multipart forms, JSON
+ * for the rest.
+*/
+void serialize_request(const HttpRequest& request, std::string& out);
+
+void serialize_json(const JsonNode& node, std::string& out);
+
+/**
+ * @brief Builds the request of an input into a reused buffer. The
+ * "request" field holds a whole request, which goes through
+ * parse_request() so that its Content-Length always fits the body.
+*/
+void createHttpRequest(const std::vector<Input>& inputs, std::string& out);
@@ -1,19 +1,28 @@
 from typing import Any
 from coverage import Coverage
 import atexit
+import os
 
 
 class CoverageMiddleware:
     def __init__(self, get_response) -> None:
         self.get_response = get_response
-        self.cov = Coverage(branch=True, config_file=".coveragerc")
+        if os.environ.get("__FUZZ_SHM_ID"):
+            # The fuzzer reads the coverage straight from shared memory
+            import fuzz_coverage
+            root = os.path.join(os.path.dirname(__file__), "..")
+            self.cov = fuzz_coverage.ShmCoverage(root)
+        else:
+            self.cov = Coverage(branch=True, config_file=".coveragerc")
     
     def exit_fn(self):
         self.cov.stop()
         self.cov.save()
 
     def __call__(self, request) -> Any:
-        self.cov.start()       
+        # Each request writes a data file of its own arcs only
+        self.cov.erase()
+        self.cov.start()
         atexit.register(self.exit_fn)
         response = self.get_response(request)
         self.cov.stop()
@@ -0,0 +1,42 @@
+#include "alloc_count.h"
+#include <cstdlib>
+#include <new>
+
+#ifdef COUNT_ALLOCATIONS
+static size_t allocations = 0;
+
+void* operator new(size_t size) {
+    allocations++;
+    if (void* p = malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+size_t heap_allocations() {
+    return allocations;
+}
+#else
+size_t heap_allocations() {
+    return 0;
+}
+#endif
@@ -0,0 +1,6 @@
+#pragma once
+#include <cstddef>
+
+// Number of heap allocations so far. Only counted in builds with
+// COUNT_ALLOCS=1, which checks that mutating an input does not allocate.
+size_t heap_allocations();
@@ -0,0 +1,329 @@
+#include <getopt.h>    // For getopt_long()
+#include <unistd.h>    // For fork()
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "config.h"
+#include "coverage.h"
+#include "driver.h"
+#include "inputs.h"
+#include "shm.h"
+
+namespace fs = std::filesystem;
+
+int worker_id = 0;
+bool persistent_session = false;
+
+// One input of the directories being minimized, with what its run covered
+typedef struct {
+    fs::path path;
+    InputSeed seed;
+    uint32_t size;  // Bytes over all fields
+    uint32_t exec_us;
+    bool failed;
+    bool run;  // Whether a worker reported its run
+    std::vector<uint32_t> tuples;
+} CminEntry;
+
+// Tuples of failing runs are kept apart from those of runs that went fine,
+// like the two tracking maps of the fuzzer
+const uint32_t FAILED_TUPLES = SIZE * 8;
+
+void usage(const char* argv0) {
+    std::cerr << "Usage: " << argv0 << " [-j <servers>] [--standby <servers>] [--persistent] [--crashes]"
+              << " [--dry-run] -o <output dir> <input dir>..." << std::endl;
+}
+
+/**
+ * @brief Reads an input as the fuzzer saved it. Fields the file lacks, such
+ * as those added to the config after it was written, are filled in by
+ * readSeed().
+*/
+static InputSeed read_input(const fs::path& path,
+                            const std::vector<Field>& fields) {
+    std::ifstream file{path};
+    return readSeed(json::parse(file), fields);
+}
+
+/**
+ * @brief Creates the coverage map of this worker in shared memory and tells
+ * the Python servers about it, see create_coverage_map() of the fuzzer.
+*/
+static coverage_map& create_cmin_map() {
+    static std::string name;
+    name = "/cmin_" + std::to_string(getpid()) + "_cov";
+    auto map = static_cast<coverage_map*>(
+        create_shared_region(name, sizeof(coverage_map)));
+    std::atexit([] { remove_shared_region(name); });
+
+    setenv(COVERAGE_SHM_ENV, name.c_str(), 1);
+    std::string pythonpath = fs::current_path().string();
+    if (getenv("PYTHONPATH"))
+        pythonpath += ":" + std::string(getenv("PYTHONPATH"));
+    setenv("PYTHONPATH", pythonpath.c_str(), 1);
+    return *map;
+}
+
+/**
+ * @brief Runs every workers-th input, starting at the worker's index,
+ * against the worker's own server and writes one line per input to the
+ * results file: its index, exec time in µs, whether it failed and its
+ * tuples.
+*/
+static void replay(const std::vector<CminEntry>& entries, int workers,
+                   const fs::path& results_path) {
+    coverage_map& map = create_cmin_map();
+    pid_t pid = start_server();
+    map.fill(0);  // Drop what the probe covered
+
+    std::ofstream results{results_path, std::ios::trunc};
+    std::vector<Input> inputs;
+    std::vector<uint32_t> tuples;
+    for (size_t i = worker_id; i < entries.size() && !stop_requested;
+         i += workers) {
+        makeInputsFromSeed(entries[i].seed, inputs);
+        auto run_start = std::chrono::steady_clock::now();
+        bool failed = run_driver(map, inputs);
+        auto exec_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::steady_clock::now() - run_start)
+                           .count();
+        coverage_tuples(map, tuples);
+        map.fill(0);
+
+        results << i << " " << exec_us << " " << failed;
+        for (uint32_t tuple : tuples)
+            results << " " << (failed ? tuple + FAILED_TUPLES : tuple);
+        results << std::endl;
+
+        if (failed) {
+            restart_server(pid);
+            map.fill(0);
+        }
+        tend_servers();
+    }
+}
+
+static void read_results(const fs::path& results_path,
+                         std::vector<CminEntry>& entries) {
+    std::ifstream results{results_path};
+    std::string line;
+    while (std::getline(results, line)) {
+        std::istringstream fields{line};
+        size_t i;
+        uint32_t exec_us;
+        bool failed;
+        if (!(fields >> i >> exec_us >> failed) || i >= entries.size())
+            continue;
+        CminEntry& entry = entries[i];
+        entry.exec_us = exec_us;
+        entry.failed = failed;
+        entry.run = true;
+        uint32_t tuple;
+        while (fields >> tuple)
+            entry.tuples.push_back(tuple);
+    }
+}
+
+/**
+ * @brief Greedy set cover like afl-cmin. Every tuple has a best input, the
+ * one hitting it with the smallest size times exec time. Going from the
+ * rarest tuple to the most common one, the best input of each tuple that
+ * no kept input hits yet is kept.
+ *
+ * @return Indices of the kept inputs, in the order of the entries.
+*/
+static std::vector<uint32_t> minimize(const std::vector<CminEntry>& entries,
+                                      const std::vector<uint32_t>& candidates) {
+    const uint32_t none = UINT32_MAX;
+    std::vector<uint32_t> best(2 * FAILED_TUPLES, none);
+    std::vector<uint32_t> hits(2 * FAILED_TUPLES, 0);
+    auto cost = [&](uint32_t i) {
+        return uint64_t(entries[i].size + 1) *
+               std::max<uint32_t>(entries[i].exec_us, 1);
+    };
+    for (uint32_t i : candidates) {
+        for (uint32_t tuple : entries[i].tuples) {
+            hits[tuple]++;
+            if (best[tuple] == none || cost(i) < cost(best[tuple]))
+                best[tuple] = i;
+        }
+    }
+
+    std::vector<uint32_t> order;
+    for (uint32_t tuple = 0; tuple < hits.size(); tuple++) {
+        if (hits[tuple])
+            order.push_back(tuple);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return hits[a] < hits[b];
+    });
+
+    std::vector<uint8_t> covered(hits.size(), 0);
+    std::vector<uint8_t> kept(entries.size(), 0);
+    for (uint32_t tuple : order) {
+        if (covered[tuple])
+            continue;
+        kept[best[tuple]] = 1;
+        for (uint32_t t : entries[best[tuple]].tuples)
+            covered[t] = 1;
+    }
+
+    std::vector<uint32_t> result;
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        if (kept[i])
+            result.push_back(i);
+    }
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    int workers = 1;
+    bool keep_crashes = false;
+    bool dry_run = false;
+    fs::path output_path;
+    const struct option long_options[] = {
+        {"workers", required_argument, nullptr, 'j'},
+        {"standby", required_argument, nullptr, 'k'},
+        {"persistent", no_argument, nullptr, 'p'},
+        {"crashes", no_argument, nullptr, 'C'},
+        {"dry-run", no_argument, nullptr, 'n'},
+        {"output", required_argument, nullptr, 'o'},
+        {nullptr, 0, nullptr, 0}};
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:o:C", long_options, nullptr)) !=
+           -1) {
+        switch (opt) {
+            case 'j':
+                workers = atoi(optarg);
+                break;
+            case 'k':
+                standby_servers = atoi(optarg);
+                break;
+            case 'p':
+                persistent_session = true;
+                break;
+            case 'C':
+                keep_crashes = true;
+                break;
+            case 'n':
+                dry_run = true;
+                break;
+            case 'o':
+                output_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (workers < 1 || workers > INSTANCE_PORT_STRIDE || standby_servers < 0 ||
+        (output_path.empty() && !dry_run) || optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!dry_run && fs::exists(output_path) && !fs::is_empty(output_path)) {
+        std::cerr << "Output directory " << output_path << " is not empty"
+                  << std::endl;
+        return 1;
+    }
+
+    std::ifstream file{config_file};
+    const json config = json::parse(file);
+    // Seeds point into the fields, they stay unchanged until the end
+    const std::vector<Field> fields = readFields(config);
+
+    // Every JSON file below the input directories, so that the output
+    // directory of a run with -j can be given as a whole
+    std::vector<fs::path> paths;
+    for (int arg = optind; arg < argc; arg++) {
+        for (const auto& entry : fs::recursive_directory_iterator{argv[arg]}) {
+            if (entry.is_regular_file() && entry.path().extension() == ".json")
+                paths.push_back(entry.path());
+        }
+    }
+    std::sort(paths.begin(), paths.end());
+
+    std::vector<CminEntry> entries;
+    for (const auto& path : paths) {
+        CminEntry entry{};
+        entry.path = path;
+        try {
+            entry.seed = read_input(path, fields);
+        } catch (const std::exception& e) {
+            std::cerr << "Skipping " << path << ": " << e.what() << std::endl;
+            continue;
+        }
+        for (const auto& field : entry.seed.inputs)
+            entry.size += field.data.size();
+        entries.push_back(std::move(entry));
+    }
+    // Only checks that every input still fits the config, without servers
+    if (dry_run) {
+        printf("Read %zu of %zu inputs\n", entries.size(), paths.size());
+        return entries.size() == paths.size() ? 0 : 1;
+    }
+    printf("Replaying %zu inputs on %d servers\n", entries.size(), workers);
+
+    // Each worker runs its share of the inputs against its own server, like
+    // the workers of the fuzzer, and leaves its results in a file
+    fs::create_directories(output_path);
+    auto results_path = [&](int w) {
+        return output_path / (".cmin_worker" + std::to_string(w));
+    };
+    fflush(stdout);
+    catch_stop_signals();
+    std::vector<pid_t> worker_pids;
+    for (int w = 0; w < workers; w++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            std::cerr << "Failed to fork worker " << w << std::endl;
+            break;
+        } else if (pid == 0) {
+            worker_id = w;
+            replay(entries, workers, results_path(w));
+            exit(0);
+        }
+        worker_pids.push_back(pid);
+    }
+    wait_for_workers(worker_pids);
+    for (int w = 0; w < workers; w++) {
+        read_results(results_path(w), entries);
+        fs::remove(results_path(w));
+    }
+    if (stop_requested) {
+        std::cerr << "Stopped, nothing written" << std::endl;
+        return 1;
+    }
+
+    // Crashing inputs would crash the server of every pass over them, so
+    // they are left out of the seeds unless asked for
+    std::vector<uint32_t> candidates;
+    size_t crashes = 0, missing = 0;
+    for (uint32_t i = 0; i < entries.size(); i++) {
+        if (!entries[i].run)
+            missing++;
+        else if (entries[i].failed && !keep_crashes)
+            crashes++;
+        else
+            candidates.push_back(i);
+    }
+    if (missing > 0)
+        std::cerr << missing << " inputs were not run" << std::endl;
+
+    const auto kept = minimize(entries, candidates);
+    for (size_t k = 0; k < kept.size(); k++) {
+        std::ofstream output_file{output_path /
+                                  ("input" + std::to_string(k) + ".json")};
+        output_file << std::setw(4) << entries[kept[k]].seed.to_json()
+                    << std::endl;
+    }
+    printf("Kept %zu of %zu inputs, %zu crashing inputs left out\n",
+           kept.size(), candidates.size(), crashes);
+    return 0;
+}
@@ -1,10 +1,13 @@
 #include "config.h"
 #include <limits.h>    // For INT_MAX
+#include <algorithm>   // For std::find_if
 #include <cstddef>     // For std::byte
+#include <cstring>     // For std::memcpy
 #include <filesystem>  // For file paths
 #include <fstream>     // For reading files
 #include <iostream>    // For some basic debugging
 #include <vector>
+#include "fixup.h"
 
 namespace fs = std::filesystem;
 
@@ -51,11 +54,15 @@ std::vector<Field> readFields(const json& j) {
     if (j.contains("choice_folder")) {
         p = j["choice_folder"].get<std::string>();
     }
+    // Names of the fields each field is computed from, resolved at the end
+    // as fields can refer to ones that come later
+    std::vector<std::vector<std::string>> fixup_names;
     for (auto& it : json_fields.items()) {
         json field_conf = it.value();
         Field f;
 
         f.name = it.key();
+        f.index = fields.size();
 
         FieldTypes type;
         // Check the type of the choices
@@ -127,23 +134,107 @@ std::vector<Field> readFields(const json& j) {
                 vec.push_back(static_cast<std::byte>(c));
             f.validSet = vec;
         }
+
+        // Tokens for the dictionary mutations, from an AFL dictionary file
+        // and listed in the config
+        if (field_conf.contains("dictionary")) {
+            load_dictionary(field_conf["dictionary"].get<std::string>(),
+                            f.tokens);
+        }
+        if (field_conf.contains("tokens")) {
+            for (auto& token : field_conf["tokens"]) {
+                std::string val = token.get<std::string>();
+                f.tokens.add(reinterpret_cast<const std::byte*>(val.data()),
+                             val.size());
+            }
+        }
+        // Fields the driver mutates itself instead of the byte mutators
+        if (field_conf.contains("mutator")) {
+            f.mutator = field_conf["mutator"].get<std::string>();
+        }
+
+        // Fix-ups: a length or CRC-16 of other fields, written over
+        // max_length bytes, and a length the data is cut to
+        f.fixup = FieldFixup::NONE;
+        fixup_names.emplace_back();
+        for (auto kind : {FieldFixup::LENGTH_OF, FieldFixup::CRC_OF}) {
+            const char* key =
+                kind == FieldFixup::LENGTH_OF ? "length_of" : "crc_of";
+            if (!field_conf.contains(key))
+                continue;
+            if (f.fixup != FieldFixup::NONE)
+                throw std::runtime_error(
+                    "Field " + f.name + " has both length_of and crc_of");
+            if (f.maxLen < 1 || f.maxLen > sizeof(uint64_t))
+                throw std::runtime_error(
+                    "Field " + f.name +
+                    " is computed, its max_length must be 1 to 8 bytes");
+            f.fixup = kind;
+            const json& sources = field_conf[key];
+            if (sources.is_array())
+                fixup_names.back() = sources.get<std::vector<std::string>>();
+            else
+                fixup_names.back().push_back(sources.get<std::string>());
+        }
+        f.littleEndian = field_conf.value("little_endian", false);
+        f.clampTo = field_conf.value("clamp_to", UINT_MAX);
         fields.push_back(f);
     }
+
+    for (auto& f : fields) {
+        for (const auto& name : fixup_names[f.index]) {
+            auto source = std::find_if(
+                fields.begin(), fields.end(),
+                [&](const Field& other) { return other.name == name; });
+            if (source == fields.end())
+                throw std::runtime_error("Field " + f.name +
+                                         " is computed from unknown field " +
+                                         name);
+            f.fixupSources.push_back(source->index);
+        }
+    }
     return fields;
 }
 
-InputSeed readSeed(const json& j, std::vector<Field>& fields) {
+/**
+ * @brief Value of a field that a seed lacks, such as one added to the config
+ * after the seed was written: its first choice, or min_length zero bytes
+ * (0 for integers) if it has no choices. Fields with a fix-up get max_length
+ * zero bytes, which fixup_seed() overwrites.
+*/
+static json defaultFieldValue(const Field& f) {
+    if (f.fixup != FieldFixup::NONE && f.type != FieldTypes::INTEGER)
+        return std::vector<uint8_t>(f.maxLen);
+    if (f.type == FieldTypes::INTEGER) {
+        int val = 0;
+        if (!f.validChoices.empty())
+            std::memcpy(&val, f.validChoices[0].data(), sizeof(int));
+        return val;
+    }
+    if (!f.validChoices.empty())
+        return binary_to_int(f.validChoices[0]);
+    return std::vector<uint8_t>(f.minLen);
+}
+
+InputSeed readSeed(const json& j, const std::vector<Field>& fields) {
     InputSeed ret;
-    for (Field f : fields) {
-        if (!j.contains(f.name))
-            throw std::runtime_error(
-                "Seed does not contain required field value");
+    bool computed_missing = false;
+    for (const Field& f : fields) {
+        if (f.fixup != FieldFixup::NONE && !j.contains(f.name))
+            computed_missing = true;
+        const json value = j.contains(f.name) ? j[f.name] : defaultFieldValue(f);
         InputField inp;
-        inp.format = f;
+        inp.format = &f;
         FieldTypes type = f.type;
         switch (type) {
             case FieldTypes::STRING: {
-                std::string val = j[f.name].get<std::string>();
+                // Saved inputs hold strings as byte arrays, see to_json()
+                if (value.is_array()) {
+                    const std::vector<uint8_t> val = value;
+                    inp.data = int_to_binary(val);
+                    break;
+                }
+                std::string val = value.get<std::string>();
                 std::vector<std::byte> vec;
                 for (char c : val)
                     vec.push_back(static_cast<std::byte>(c));
@@ -152,14 +243,14 @@ InputSeed readSeed(const json& j, std::vector<Field>& fields) {
                 break;
             }
             case FieldTypes::INTEGER: {
-                int val = j[f.name].get<int>();
+                int val = value.get<int>();
                 inp.data = std::vector<std::byte>(
                     reinterpret_cast<std::byte*>(&val),
                     reinterpret_cast<std::byte*>(&val) + sizeof(int));
                 break;
             }
             case FieldTypes::BINARY: {
-                const std::vector<uint8_t> val = j[f.name];
+                const std::vector<uint8_t> val = value;
                 inp.data = int_to_binary(val);
                 break;
             }
@@ -168,52 +259,41 @@ InputSeed readSeed(const json& j, std::vector<Field>& fields) {
         }
         ret.inputs.push_back(inp);
     }
+    // Computed fields the seed lacks, such as a length field added to the
+    // config after it was written, are worked out from the other fields
+    if (computed_missing)
+        fixup_seed(ret);
     return ret;
 }
 
-std::vector<Input> makeInputsFromSeed(const InputSeed& seed) {
-    std::vector<Input> out{};
-    for (InputField inpf : seed.inputs) {
-        Input in;
-        in.data = inpf.data;
-        in.name = inpf.format.name;
-        out.push_back(in);
+/**
+ * @brief Fills the inputs for the driver from a seed. The vector is meant to
+ * be reused, once its buffers are big enough this does not allocate.
+*/
+void makeInputsFromSeed(const InputSeed& seed, std::vector<Input>& inputs) {
+    inputs.resize(seed.inputs.size());
+    for (size_t i = 0; i < seed.inputs.size(); i++) {
+        inputs[i].data.assign(seed.inputs[i].data.begin(),
+                              seed.inputs[i].data.end());
+        inputs[i].name = seed.inputs[i].format->name;
     }
-    return out;
 }
 
+/**
+ * @brief Reads a bug file the same way as the seeds, so that string fields
+ * can hold either text or the byte arrays the fuzzer saves.
+*/
 std::vector<Input> inputsFromBugFile(const std::string& bug_filename,
                                      const std::string& config_filename) {
-    std::vector<Input> inputs;
     std::ifstream config_file(config_filename);
     auto json_config = json::parse(config_file);
-    auto fields = readFields(json_config);
+    const auto fields = readFields(json_config);
 
     std::ifstream bug_file(bug_filename);
     json j = json::parse(bug_file);
-    for (auto field : fields) {
-        if (!j.contains(field.name))
-            throw std::runtime_error(
-                "Seed does not contain required field value");
-        Input i;
-        i.name = field.name;
-        switch (field.type) {
-            case FieldTypes::INTEGER: {
-                int val = j[field.name].get<int>();
-                i.data = std::vector<std::byte>(
-                    reinterpret_cast<std::byte*>(&val),
-                    reinterpret_cast<std::byte*>(&val) + sizeof(int));
-                inputs.push_back(i);
-                break;
-            }
-            default: {
-                const std::vector<uint8_t> val = j[field.name];
-                i.data = int_to_binary(val);
-                inputs.push_back(i);
-                break;
-            }
-        }
-    }
+    // The seed points into the fields, the inputs are filled while they live
+    std::vector<Input> inputs;
+    makeInputsFromSeed(readSeed(j, fields), inputs);
     return inputs;
 }
 
@@ -6,7 +6,7 @@
 using json = nlohmann::json;
 
 std::vector<Field> readFields(const json& j);
-InputSeed readSeed(const json& j, std::vector<Field>& fields);
+InputSeed readSeed(const json& j, const std::vector<Field>& fields);
 std::vector<std::byte> int_to_binary(const std::vector<uint8_t>& json_bin);
 std::vector<uint8_t> binary_to_int(const std::vector<std::byte>& byte_arr);
 std::vector<Input> inputsFromBugFile(const std::string& bug_filename,
@@ -72,6 +72,75 @@ std::vector<Input> inputsFromBugFile(const std::string& bug_filename,
 
 #define ARITH_MAX 35
 
+/* Fields shorter than this count every byte as effective in the
+   deterministic stages, the effector map only pays off for longer ones: */
+
+#define EFF_MIN_LEN 128
+
+/* If more than this percentage of a field's bytes is effective, the whole
+   field is treated as effective: */
+
+#define EFF_MAX_PERC 90
+
+/* Trimming: chunks of a field removed at a time go from 1/TRIM_START_STEPS
+   of its length (rounded up to a power of 2) down to 1/TRIM_END_STEPS, but
+   never below TRIM_MIN_BYTES: */
+
+#define TRIM_MIN_BYTES 4
+#define TRIM_START_STEPS 16
+#define TRIM_END_STEPS 1024
+
+/* Probabilities of skipping a seed (percent): one that was fuzzed or is not
+   favored while favored seeds wait for their first pass, and one that is not
+   favored otherwise, after its first cycle without a pass or once it had
+   one: */
+
+#define SKIP_TO_NEW_PROB 99
+#define SKIP_NFAV_NEW_PROB 75
+#define SKIP_NFAV_OLD_PROB 95
+
+/* Power schedules other than the exponential one: havoc runs of a seed
+   before its factor is applied and at most, unless the config says
+   otherwise, and the largest factor (AFLFast's MAX_FACTOR): */
+
+#define POWER_BASE_ENERGY 16
+#define POWER_MAX_ENERGY 1024
+#define POWER_MAX_FACTOR 32
+
+/* Base energy of the exponential schedule, the default one, which doubles
+   it with every pass and is not capped unless the config says so: */
+
+#define POWER_EXPONENTIAL_BASE_ENERGY 1
+
+/* Number of seeds a seed is spliced with, sharing its energy: */
+
+#define SPLICE_CYCLES 15u
+
+/* Percentage of havoc runs that skip the fix-ups of the config by default: */
+
+#define FIXUP_SKIP_PERC 5
+
 /* Maximum size of input file, in bytes (keep under 100MB): */
 
-#define MAX_FILE (1 * 1024 * 1024)
\ No newline at end of file
+#define MAX_FILE (1 * 1024 * 1024)
+/* Length limits of the tokens found by the byte flips, and how many are kept
+   per field: */
+
+#define MIN_AUTO_EXTRA 3
+#define MAX_AUTO_EXTRA 32
+#define MAX_AUTO_EXTRAS 500
+
+/* Maximum length of a dictionary token: */
+
+#define MAX_DICT_FILE 128
+
+/* Havoc operator schedule: the probabilities are updated every
+   OPERATOR_UPDATE_EXECS havoc runs, with OPERATOR_EXPLORE of them spread
+   evenly over all operators. Counts decay by OPERATOR_DECAY with every
+   update, and OPERATOR_PRIOR_USES uses at the field's average yield are
+   added to every operator: */
+
+#define OPERATOR_UPDATE_EXECS 500
+#define OPERATOR_EXPLORE 0.1
+#define OPERATOR_DECAY 0.9
+#define OPERATOR_PRIOR_USES 50
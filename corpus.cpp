@@ -0,0 +1,68 @@
+#include "corpus.h"
+#include <algorithm>
+#include <stdexcept>
+
+/**
+ * @brief Appends a seed to the store.
+ *
+ * @return Its index, which stays valid for as long as the store lives.
+*/
+uint32_t SeedStore::add(const InputSeed& seed) {
+    if (seed.inputs.size() != schema.size())
+        throw std::runtime_error("Seed does not match the config fields");
+
+    SeedInfo info{};
+    info.first_span = spans.size();
+    info.file = -1;
+    for (auto& field : seed.inputs) {
+        spans.push_back(
+            {bytes.size(), static_cast<uint32_t>(field.data.size())});
+        bytes.insert(bytes.end(), field.data.begin(), field.data.end());
+        info.size += field.data.size();
+    }
+    seeds.push_back(info);
+    return seeds.size() - 1;
+}
+
+/**
+ * @brief Copies a stored seed into a reused InputSeed. Once its buffers are
+ * big enough this does not allocate.
+*/
+void SeedStore::load(uint32_t id, InputSeed& seed) const {
+    seed.inputs.resize(schema.size());
+    for (size_t i = 0; i < schema.size(); i++) {
+        const FieldSpan& span = spans[seeds[id].first_span + i];
+        seed.inputs[i].format = &schema[i];
+        seed.inputs[i].data.assign(bytes.begin() + span.offset,
+                                   bytes.begin() + span.offset + span.length);
+    }
+}
+
+/**
+ * @brief Replaces a stored seed with a version of it where no field is
+ * longer than before, like a trimmed one. The new data is written over the
+ * old, the bytes it no longer needs are left unused.
+*/
+void SeedStore::shrink(uint32_t id, const InputSeed& seed) {
+    SeedInfo& info = seeds[id];
+    info.size = 0;
+    for (size_t i = 0; i < schema.size(); i++) {
+        FieldSpan& span = spans[info.first_span + i];
+        const auto& data = seed.inputs[i].data;
+        if (data.size() > span.length)
+            throw std::runtime_error("Shrunk seed has a longer field");
+        std::copy(data.begin(), data.end(), bytes.begin() + span.offset);
+        span.length = data.size();
+        info.size += data.size();
+    }
+}
+
+/**
+ * @brief Stores the trace of a seed. A seed gets one trace, when it is
+ * calibrated.
+*/
+void SeedStore::set_trace(uint32_t id, const std::vector<uint32_t>& trace) {
+    seeds[id].first_edge = edges.size();
+    seeds[id].edge_count = trace.size();
+    edges.insert(edges.end(), trace.begin(), trace.end());
+}
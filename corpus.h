@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "inputs.h"
+
+// Where the data of one field of a stored seed lives in the byte store
+typedef struct {
+    uint64_t offset;
+    uint32_t length;
+} FieldSpan;
+
+// Scheduling data of a stored seed, kept apart from its bytes
+typedef struct {
+    uint32_t first_span;  // Spans of its fields follow in schema order
+    uint32_t size;        // Bytes over all fields
+    unsigned int energy;
+    int chosen_count;
+    bool deterministic_done;  // Whether it went through deterministic_stages()
+    bool trim_done;           // Whether it went through trim_seed()
+    int32_t file;  // Number of its file in interesting/, -1 if it has none
+    // Set by SeedScheduler, see scheduler.h
+    bool calibrated;   // Whether its trace and exec time are known
+    bool favored;      // Top rated for an entry no favored seed before it hits
+    bool was_fuzzed;   // Whether it had a pass of its own
+    uint32_t exec_us;  // Average run time of the input and its mutants
+    uint64_t exec_total_us;  // Run time and runs behind that average
+    uint32_t exec_runs;
+    uint32_t path_cksum;  // Coverage checksum of that run
+    uint64_t first_edge;  // Coverage map entries it hit, in the trace store
+    uint32_t edge_count;
+} SeedInfo;
+
+/**
+ * @brief All seeds of the corpus in flat arrays: the field data of every
+ * seed back to back in one byte store, a span per field, a small info
+ * record per seed and the coverage traces back to back. Seeds are referred to by their index and only copied out
+ * into an InputSeed when they are mutated.
+*/
+class SeedStore {
+   public:
+    explicit SeedStore(const std::vector<Field>& schema) : schema(schema) {}
+
+    uint32_t add(const InputSeed& seed);
+    void load(uint32_t id, InputSeed& seed) const;
+    void shrink(uint32_t id, const InputSeed& seed);
+
+    // Coverage map entries a run of the seed hit, see coverage_trace()
+    void set_trace(uint32_t id, const std::vector<uint32_t>& edges);
+    const uint32_t* trace(uint32_t id) const {
+        return edges.data() + seeds[id].first_edge;
+    }
+
+    SeedInfo& info(uint32_t id) { return seeds[id]; }
+    const SeedInfo& info(uint32_t id) const { return seeds[id]; }
+    size_t size() const { return seeds.size(); }
+    const std::vector<Field>& fields() const { return schema; }
+
+   private:
+    const std::vector<Field>& schema;
+    std::vector<std::byte> bytes;
+    std::vector<FieldSpan> spans;
+    std::vector<SeedInfo> seeds;
+    std::vector<uint32_t> edges;
+};
@@ -0,0 +1,315 @@
+#include "coverage.h"
+#include <immintrin.h>  // For the SSE4.1 / AVX2 intrinsics
+#include <array>
+#include <cstring>  // For memcpy
+
+/*
+ * Hit count bucketing used by isInteresting().
+ *
+ * Every map entry with a non-zero hit count falls into one bucket, looked up
+ * in a table. If the tracking map hasn't seen that bucket for the entry yet,
+ * it gets recorded and the input is interesting.
+ *
+ * The map is mostly zeroes, so the kernels below skip over zero words and
+ * only look at the buckets of the few entries that were hit. The map is
+ * cleared in the same pass, ready for the next run.
+*/
+
+/**
+ * @brief Bucket bit of every count from 0 to 255. Larger counts are clamped
+ * to 255 before the lookup, every bucket starts below that.
+*/
+template <typename Buckets>
+struct BucketTables {
+    static constexpr std::array<uint8_t, 256> make_lut() {
+        std::array<uint8_t, 256> lut{};
+        for (int i = 0; i < 256; i++)
+            lut[i] = Buckets::bucket_bit(i);
+        return lut;
+    }
+
+    static constexpr std::array<uint8_t, 256> lut = make_lut();
+
+    /*
+     * The vector kernels can't index a 256 entry table, so they split it
+     * into two 16 entry tables for pshufb: one for counts below 16, indexed
+     * by the low nibble, and one for the rest, indexed by the high nibble.
+     * This only works if the buckets above 15 start on multiples of 16.
+    */
+    static constexpr std::array<uint8_t, 16> make_low_lut() {
+        std::array<uint8_t, 16> low{};
+        for (int i = 0; i < 16; i++)
+            low[i] = lut[i];
+        return low;
+    }
+
+    static constexpr std::array<uint8_t, 16> make_high_lut() {
+        std::array<uint8_t, 16> high{};
+        for (int i = 1; i < 16; i++)
+            high[i] = lut[i << 4];
+        return high;
+    }
+
+    static constexpr std::array<uint8_t, 16> low_lut = make_low_lut();
+    static constexpr std::array<uint8_t, 16> high_lut = make_high_lut();
+
+    static constexpr bool nibble_split() {
+        for (int i = 16; i < 256; i++) {
+            if (lut[i] != high_lut[i >> 4])
+                return false;
+        }
+        return true;
+    }
+};
+
+// A template, so that the comparison is not even compiled for 8 bit
+// counters, which never go above 255 and would warn about it
+template <typename Count>
+static inline uint8_t clamp_count(Count count) {
+    if constexpr (sizeof(Count) > 1)
+        return count > 255 ? 255 : count;
+    else
+        return count;
+}
+
+/**
+ * @brief Records the new bucket of one map entry in the tracking map.
+ * @param fresh The bit of the entry's bucket, which was not seen yet.
+ * @return Whether the bucket was newly recorded by this call. Another worker
+ * may have recorded it in the meantime, in which case it isn't new anymore.
+*/
+static inline bool record_bucket(char* tracking, int i, uint8_t fresh) {
+    char bit = static_cast<char>(fresh);
+    return !(__atomic_fetch_or(&tracking[i], bit, __ATOMIC_RELAXED) & bit);
+}
+
+/**
+ * @brief Looks up the buckets of a block of map entries one by one.
+*/
+template <typename Buckets>
+static inline bool classify_block(const cov_count_t* data, char* tracking,
+                                  int start, int len) {
+    bool is_interesting = false;
+    for (int i = start; i < start + len; i++) {
+        uint8_t seen = __atomic_load_n(&tracking[i], __ATOMIC_RELAXED);
+        uint8_t fresh = BucketTables<Buckets>::lut[clamp_count(data[i])] & ~seen;
+        if (fresh && record_bucket(tracking, i, fresh))
+            is_interesting = true;
+    }
+    return is_interesting;
+}
+
+template <typename Buckets>
+static bool classify_scalar(cov_count_t* data, char* tracking) {
+    const int block = sizeof(uint64_t) / sizeof(cov_count_t);
+    bool is_interesting = false;
+    for (int i = 0; i < SIZE; i += block) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        if (word == 0)
+            continue;
+        if (classify_block<Buckets>(data, tracking, i, block))
+            is_interesting = true;
+        memset(data + i, 0, sizeof(word));
+    }
+    return is_interesting;
+}
+
+/*
+ * The vector kernels work on 16 / 32 map entries at a time. With 16 bit
+ * counters, the entries are clamped to 255 and packed down to bytes first.
+ *
+ * They read the tracking map without atomics. A stale read only means a
+ * bucket looks new when another worker just recorded it, and record_bucket()
+ * sorts that out.
+*/
+
+__attribute__((target("sse4.1"))) static inline __m128i load_counts_sse41(
+    const cov_count_t* data) {
+#ifdef COVERAGE_COUNTERS_16
+    const __m128i max = _mm_set1_epi16(255);
+    __m128i a = _mm_min_epu16(_mm_loadu_si128((const __m128i*)data), max);
+    __m128i b = _mm_min_epu16(_mm_loadu_si128((const __m128i*)data + 1), max);
+    return _mm_packus_epi16(a, b);
+#else
+    return _mm_loadu_si128((const __m128i*)data);
+#endif
+}
+
+template <typename Buckets>
+__attribute__((target("sse4.1"))) static bool classify_sse41(
+    cov_count_t* data, char* tracking) {
+    typedef BucketTables<Buckets> Tables;
+    const int block = 16;
+    const __m128i low = _mm_loadu_si128((const __m128i*)Tables::low_lut.data());
+    const __m128i high =
+        _mm_loadu_si128((const __m128i*)Tables::high_lut.data());
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    bool is_interesting = false;
+
+    for (int i = 0; i < SIZE; i += block) {
+        __m128i counts = load_counts_sse41(data + i);
+        if (_mm_testz_si128(counts, counts))
+            continue;
+
+        __m128i lo = _mm_and_si128(counts, nibble);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(counts, 4), nibble);
+        __m128i buckets =
+            _mm_blendv_epi8(_mm_shuffle_epi8(high, hi),
+                            _mm_shuffle_epi8(low, lo), _mm_cmpeq_epi8(hi, zero));
+        __m128i seen = _mm_loadu_si128((const __m128i*)(tracking + i));
+        __m128i fresh = _mm_andnot_si128(seen, buckets);
+
+        if (!_mm_testz_si128(fresh, fresh) &&
+            classify_block<Buckets>(data, tracking, i, block))
+            is_interesting = true;
+        memset(data + i, 0, block * sizeof(cov_count_t));
+    }
+    return is_interesting;
+}
+
+__attribute__((target("avx2"))) static inline __m256i load_counts_avx2(
+    const cov_count_t* data) {
+#ifdef COVERAGE_COUNTERS_16
+    const __m256i max = _mm256_set1_epi16(255);
+    __m256i a = _mm256_min_epu16(_mm256_loadu_si256((const __m256i*)data), max);
+    __m256i b =
+        _mm256_min_epu16(_mm256_loadu_si256((const __m256i*)data + 1), max);
+    // Packing works per 128 bit lane, put the quarters back in order
+    return _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+#else
+    return _mm256_loadu_si256((const __m256i*)data);
+#endif
+}
+
+template <typename Buckets>
+__attribute__((target("avx2"))) static bool classify_avx2(cov_count_t* data,
+                                                         char* tracking) {
+    typedef BucketTables<Buckets> Tables;
+    const int block = 32;
+    const __m256i low = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*)Tables::low_lut.data()));
+    const __m256i high = _mm256_broadcastsi128_si256(
+        _mm_loadu_si128((const __m128i*)Tables::high_lut.data()));
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+    bool is_interesting = false;
+
+    for (int i = 0; i < SIZE; i += block) {
+        __m256i counts = load_counts_avx2(data + i);
+        if (_mm256_testz_si256(counts, counts))
+            continue;
+
+        __m256i lo = _mm256_and_si256(counts, nibble);
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi16(counts, 4), nibble);
+        __m256i buckets = _mm256_blendv_epi8(_mm256_shuffle_epi8(high, hi),
+                                             _mm256_shuffle_epi8(low, lo),
+                                             _mm256_cmpeq_epi8(hi, zero));
+        __m256i seen = _mm256_loadu_si256((const __m256i*)(tracking + i));
+        __m256i fresh = _mm256_andnot_si256(seen, buckets);
+
+        if (!_mm256_testz_si256(fresh, fresh) &&
+            classify_block<Buckets>(data, tracking, i, block))
+            is_interesting = true;
+        memset(data + i, 0, block * sizeof(cov_count_t));
+    }
+    return is_interesting;
+}
+
+typedef bool (*classify_kernel)(cov_count_t*, char*);
+
+struct Kernel {
+    classify_kernel fn;
+    const char* name;
+};
+
+template <typename Buckets>
+static Kernel pick_kernel() {
+    __builtin_cpu_init();
+    // Buckets that can't be split into nibble tables only have the scalar
+    // kernel
+    if constexpr (BucketTables<Buckets>::nibble_split()) {
+        if (__builtin_cpu_supports("avx2"))
+            return {classify_avx2<Buckets>, "avx2"};
+        if (__builtin_cpu_supports("sse4.1"))
+            return {classify_sse41<Buckets>, "sse4.1"};
+    }
+    return {classify_scalar<Buckets>, "scalar"};
+}
+
+static const Kernel kernel = pick_kernel<DefaultBuckets>();
+
+/**
+ * @brief Buckets the hit counts of a coverage map and records new buckets in
+ * the tracking map. The coverage map is zeroed afterwards.
+ * 
+ * @param data Coverage map filled in by the driver.
+ * @param tracking Buckets seen so far, SIZE entries.
+ * @return Whether any new bucket was recorded.
+*/
+bool classify_and_reset(coverage_map& data, char* tracking) {
+    return kernel.fn(data.data(), tracking);
+}
+
+/**
+ * @brief Lists the entries of a coverage map that were hit, into a reused
+ * vector, and hashes them with the bucket they fell into. Counts that stay
+ * within their bucket hash the same, so two runs along the same path give
+ * the same checksum. Empty words are skipped, the maps of the Python
+ * targets are sparse.
+ *
+ * @return The checksum.
+*/
+uint32_t coverage_trace(const coverage_map& data,
+                        std::vector<uint32_t>& edges) {
+    const int block = sizeof(uint64_t) / sizeof(cov_count_t);
+    uint32_t hash = 2166136261u;  // FNV-1a
+    edges.clear();
+    for (int i = 0; i < SIZE; i += block) {
+        uint64_t word;
+        memcpy(&word, data.data() + i, sizeof(word));
+        if (word == 0)
+            continue;
+        for (int j = i; j < i + block; j++) {
+            if (data[j] == 0)
+                continue;
+            edges.push_back(j);
+            uint32_t entry =
+                (j << 8) |
+                BucketTables<DefaultBuckets>::lut[clamp_count(data[j])];
+            hash = (hash ^ entry) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+/**
+ * @brief Lists the (entry, bucket) tuples of a coverage map into a reused
+ * vector, as entry * 8 + bucket index, like the tuples of afl-cmin. Two
+ * inputs with the same tuples count as the same coverage.
+*/
+void coverage_tuples(const coverage_map& data, std::vector<uint32_t>& tuples) {
+    const int block = sizeof(uint64_t) / sizeof(cov_count_t);
+    tuples.clear();
+    for (int i = 0; i < SIZE; i += block) {
+        uint64_t word;
+        memcpy(&word, data.data() + i, sizeof(word));
+        if (word == 0)
+            continue;
+        for (int j = i; j < i + block; j++) {
+            if (data[j] == 0)
+                continue;
+            uint8_t bit =
+                BucketTables<DefaultBuckets>::lut[clamp_count(data[j])];
+            tuples.push_back(j * 8 + __builtin_ctz(bit));
+        }
+    }
+}
+
+/**
+ * @brief Name of the kernel picked for this CPU, for logging.
+*/
+const char* coverage_kernel_name() {
+    return kernel.name;
+}
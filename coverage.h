@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "driver.h"
+
+/**
+ * @brief Hit count buckets, given by the smallest count of each bucket in
+ * increasing order. A count falls into the last bucket whose start it
+ * reaches, and bucket k is recorded as bit k of the tracking maps.
+*/
+template <unsigned... Starts>
+struct HitBuckets {
+    static constexpr unsigned starts[] = {Starts...};
+    static constexpr int count = sizeof...(Starts);
+
+    static constexpr bool valid() {
+        for (int k = 1; k < count; k++) {
+            if (starts[k] <= starts[k - 1])
+                return false;
+        }
+        return starts[0] >= 1 && starts[count - 1] <= 255;
+    }
+
+    static_assert(count >= 1 && count <= 8,
+                  "The tracking maps have room for 8 buckets");
+    static_assert(valid(), "Bucket starts must increase from 1 up to 255");
+
+    static constexpr uint8_t bucket_bit(unsigned hits) {
+        uint8_t bit = 0;
+        for (int k = 0; k < count; k++) {
+            if (hits >= starts[k])
+                bit = 1 << k;
+        }
+        return bit;
+    }
+};
+
+// 1, 2, 3, 4-7, 8-15, 16-31, 32-127 and 128+ hits
+typedef HitBuckets<1, 2, 3, 4, 8, 16, 32, 128> DefaultBuckets;
+
+bool classify_and_reset(coverage_map& data, char* tracking);
+uint32_t coverage_trace(const coverage_map& data,
+                        std::vector<uint32_t>& edges);
+void coverage_tuples(const coverage_map& data, std::vector<uint32_t>& tuples);
+const char* coverage_kernel_name();
@@ -0,0 +1,118 @@
+#include "coverage_db.h"
+#include <sys/stat.h>  // For stat
+#include <unistd.h>    // For usleep
+#include <cstdio>
+#include <memory>
+#include "checksum.h"
+
+// How long a step waits for the server to finish writing before giving up
+const int BUSY_TIMEOUT_MS = 50;
+const int BUSY_RETRIES = 5;
+
+CoverageDbReader::CoverageDbReader(std::string filename)
+    : filename_(std::move(filename)) {}
+
+CoverageDbReader::~CoverageDbReader() { close(); }
+
+size_t CoverageDbReader::ArcHash::operator()(const Arc& arc) const {
+    uint64_t h = arc.file_id;
+    for (int64_t v : {arc.context_id, arc.from, arc.to}) {
+        h ^= static_cast<uint64_t>(v) + 0x9e3779b97f4a7c15ULL + (h << 6) +
+             (h >> 2);
+    }
+    return h;
+}
+
+bool CoverageDbReader::open() {
+    struct stat st;
+    if (stat(filename_.c_str(), &st) != 0) return false;
+
+    // Read only, so that a missing database is never created from here
+    if (sqlite3_open_v2(filename_.c_str(), &db_, SQLITE_OPEN_READONLY,
+                        nullptr) != SQLITE_OK) {
+        fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db_));
+        close();
+        return false;
+    }
+    sqlite3_busy_timeout(db_, BUSY_TIMEOUT_MS);
+
+    // Fails until the server has written the schema, so retry next time
+    const char* sql =
+        "SELECT rowid, file_id, context_id, fromno, tono FROM arc "
+        "WHERE rowid > ? ORDER BY rowid";
+    if (sqlite3_prepare_v2(db_, sql, -1, &stmt_, nullptr) != SQLITE_OK) {
+        close();
+        return false;
+    }
+    inode_ = st.st_ino;
+    last_rowid_ = 0;
+    return true;
+}
+
+void CoverageDbReader::close() {
+    sqlite3_finalize(stmt_);
+    sqlite3_close(db_);
+    stmt_ = nullptr;
+    db_ = nullptr;
+}
+
+int CoverageDbReader::read_new_arcs(coverage_map& shm) {
+    // coverage.py erases the data by deleting the file, start over if so
+    struct stat st;
+    if (db_ && (stat(filename_.c_str(), &st) != 0 || st.st_ino != inode_)) {
+        close();
+    }
+    if (!db_ && !open()) return 0;
+
+    int arcs = 0;
+    int retries = 0;
+    run_arcs_.clear();
+    sqlite3_bind_int64(stmt_, 1, last_rowid_);
+    while (true) {
+        int res = sqlite3_step(stmt_);
+        if (res == SQLITE_ROW) {
+            last_rowid_ = sqlite3_column_int64(stmt_, 0);
+            Arc arc{sqlite3_column_int64(stmt_, 1),
+                    sqlite3_column_int64(stmt_, 2),
+                    sqlite3_column_int64(stmt_, 3),
+                    sqlite3_column_int64(stmt_, 4)};
+            if (!run_arcs_.insert(arc).second) continue;
+
+            // Same hash as the original full table scan, so the map slots
+            // do not depend on which reader filled them
+            uint16_t crc = 0;
+            for (int64_t item : {arc.file_id, arc.context_id, arc.from, arc.to})
+                crc = update_crc_16(crc, item);
+            add_hits(shm[crc], 1);
+            arcs++;
+        } else if ((res == SQLITE_BUSY || res == SQLITE_LOCKED) &&
+                   retries++ < BUSY_RETRIES) {
+            // The server is still saving, continue after the last row read
+            sqlite3_reset(stmt_);
+            sqlite3_bind_int64(stmt_, 1, last_rowid_);
+            usleep(BUSY_TIMEOUT_MS * 1000);
+        } else {
+            if (res != SQLITE_DONE) {
+                fprintf(stderr, "Can't read database: %s\n",
+                        sqlite3_errmsg(db_));
+                arcs = -1;
+            }
+            break;
+        }
+    }
+    // Releases the read lock so that the server can write again
+    sqlite3_reset(stmt_);
+    return arcs;
+}
+
+/**
+ * @brief Adds the arcs of the last execution to the coverage map. The
+ * reader for the database is kept between calls.
+*/
+int hash_cov_into_shm(coverage_map& shm, const char* filename) {
+    static std::unique_ptr<CoverageDbReader> reader;
+    if (!reader || reader->filename() != filename) {
+        reader = std::make_unique<CoverageDbReader>(filename);
+    }
+    return reader->read_new_arcs(shm);
+}
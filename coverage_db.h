@@ -0,0 +1,59 @@
+#pragma once
+#include <sqlite3.h>
+#include <sys/types.h>  // For ino_t
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include "driver.h"
+
+/**
+ * @brief Reads the arcs of a coverage.py database incrementally.
+ *
+ * The servers erase their database before every request, so it only holds
+ * the arcs of the last execution. The reader keeps the database open until
+ * it is replaced and only asks for rows it has not read yet, so that a
+ * server still saving can be read on from the last row.
+*/
+class CoverageDbReader {
+   public:
+    explicit CoverageDbReader(std::string filename);
+    ~CoverageDbReader();
+    CoverageDbReader(const CoverageDbReader&) = delete;
+    CoverageDbReader& operator=(const CoverageDbReader&) = delete;
+
+    /**
+     * @brief Adds the arcs that appeared since the last call to the map, each
+     * once, whether or not earlier executions took them too.
+     *
+     * @return The number of arcs, or -1 if the database could not be read.
+     * A database that does not exist yet is not an error.
+    */
+    int read_new_arcs(coverage_map& shm);
+
+    const std::string& filename() const { return filename_; }
+
+   private:
+    struct Arc {
+        int64_t file_id, context_id, from, to;
+        bool operator==(const Arc& other) const {
+            return file_id == other.file_id &&
+                   context_id == other.context_id && from == other.from &&
+                   to == other.to;
+        }
+    };
+    struct ArcHash {
+        size_t operator()(const Arc& arc) const;
+    };
+
+    bool open();
+    void close();
+
+    std::string filename_;
+    sqlite3* db_ = nullptr;
+    sqlite3_stmt* stmt_ = nullptr;
+    ino_t inode_ = 0;         // Detects the database being erased and recreated
+    int64_t last_rowid_ = 0;  // Rows up to this one have been read
+    std::unordered_set<Arc, ArcHash> run_arcs_;  // Arcs read by this call
+};
+
+int hash_cov_into_shm(coverage_map& shm, const char* filename);
@@ -0,0 +1,87 @@
+#include "dictionary.h"
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "config.h"
+
+/**
+ * @brief Adds a token unless the table has it already.
+ * @return Whether it was added.
+*/
+bool TokenTable::add(const std::byte* data, uint32_t len) {
+    if (len == 0)
+        return false;
+    for (uint32_t i = 0; i < size(); i++) {
+        if (length(i) == len && memcmp(token(i), data, len) == 0)
+            return false;
+    }
+    bytes.insert(bytes.end(), data, data + len);
+    ends.push_back(bytes.size());
+    return true;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief Reads a dictionary in AFL's -x format. Every line is a token in
+ * double quotes, optionally preceded by a name and "=". Within the quotes,
+ * \\, \" and \xNN are escapes. Lines starting with # are comments.
+*/
+void load_dictionary(const std::string& filename, TokenTable& tokens) {
+    std::ifstream file{filename};
+    if (!file) {
+        throw std::runtime_error("Cannot open dictionary " + filename);
+    }
+
+    std::string line;
+    int line_no = 0;
+    while (std::getline(file, line)) {
+        line_no++;
+        auto error = [&](const std::string& what) {
+            return std::runtime_error(filename + ":" +
+                                      std::to_string(line_no) + ": " + what);
+        };
+
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#')
+            continue;
+        size_t open = line.find('"', start);
+        size_t close = line.find_last_of('"');
+        if (open == std::string::npos || close == open) {
+            throw error("token must be in double quotes");
+        }
+
+        std::vector<std::byte> token;
+        for (size_t i = open + 1; i < close; i++) {
+            char c = line[i];
+            if (c == '\\' && i + 1 < close) {
+                c = line[++i];
+                if (c == 'x') {
+                    int hi = i + 2 < close ? hex_digit(line[i + 1]) : -1;
+                    int lo = i + 2 < close ? hex_digit(line[i + 2]) : -1;
+                    if (hi < 0 || lo < 0) {
+                        throw error("bad \\x escape");
+                    }
+                    c = static_cast<char>(hi << 4 | lo);
+                    i += 2;
+                } else if (c != '\\' && c != '"') {
+                    throw error("unknown escape");
+                }
+            }
+            token.push_back(static_cast<std::byte>(c));
+        }
+        if (token.size() > MAX_DICT_FILE) {
+            throw error("token is longer than " +
+                        std::to_string(MAX_DICT_FILE) + " bytes");
+        }
+        tokens.add(token.data(), token.size());
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Tokens for the dictionary mutations, stored back to back in one
+ * buffer with the end of each. Picking a token is an index into the ends.
+*/
+class TokenTable {
+   public:
+    bool add(const std::byte* data, uint32_t len);
+
+    uint32_t size() const { return ends.size(); }
+    bool empty() const { return ends.empty(); }
+    const std::byte* token(uint32_t i) const {
+        return bytes.data() + (i ? ends[i - 1] : 0);
+    }
+    uint32_t length(uint32_t i) const {
+        return ends[i] - (i ? ends[i - 1] : 0);
+    }
+
+   private:
+    std::vector<std::byte> bytes;
+    std::vector<uint32_t> ends;
+};
+
+void load_dictionary(const std::string& filename, TokenTable& tokens);
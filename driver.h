@@ -1,12 +1,77 @@
 #pragma once
 #include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <string>
 #include <vector>
 #include "inputs.h"
+#include "server.h"
 
 #define STRINGIFY(x) #x
 #define GETENV(x) STRINGIFY(x)
 
 const int SIZE = 65536;
+
+// Hit counters of the coverage map. They saturate instead of wrapping around,
+// so that hot loops end up in the top bucket. Building with COUNTERS16=1
+// gives 16 bit counters, which tell apart more counts above 255 when they
+// are summed up from several sources.
+#ifdef COVERAGE_COUNTERS_16
+typedef uint16_t cov_count_t;
+#else
+typedef uint8_t cov_count_t;
+#endif
+typedef std::array<cov_count_t, SIZE> coverage_map;
+
+inline void add_hits(cov_count_t& counter, unsigned long hits) {
+    const unsigned long max = std::numeric_limits<cov_count_t>::max();
+    counter = hits >= max - counter ? max : counter + hits;
+}
 const std::string config_file = GETENV(CONFIG_FILE);
-int run_driver(std::array<char, SIZE>& shm, std::vector<Input>& inputs);
-pid_t run_server();
\ No newline at end of file
+
+// Index of this fuzzing worker. Each worker runs its own server instance, so
+// drivers use it to pick ports and scratch files that don't collide.
+extern int worker_id;
+
+// Port of the server instance the driver talks to. Workers and their standby
+// servers each get their own port above the target's base port.
+inline uint16_t server_port(int base) {
+    return base + worker_id + server_instance * INSTANCE_PORT_STRIDE;
+}
+
+// Whether to keep the target connected across inputs and only restart it when
+// it crashes or hangs. Only the BLE driver has a per-input start-up to save.
+extern bool persistent_session;
+
+// Environment variable announcing the shared memory coverage map to the
+// Python servers, like AFL's __AFL_SHM_ID. See fuzz_coverage.py.
+#define COVERAGE_SHM_ENV "__FUZZ_SHM_ID"
+
+// Whether the Python servers write their coverage straight into the map.
+// Otherwise it has to be read from their coverage.py data file.
+inline bool python_shm_coverage() {
+    return getenv(COVERAGE_SHM_ENV) != nullptr;
+}
+
+// Coverage data file written by the Python server instance the driver talks
+// to. Standbys get their own, as every request erases the file of its server.
+inline std::string coverage_data_file() {
+    std::string name = "data/.coverage";
+    if (worker_id > 0)
+        name += ".worker" + std::to_string(worker_id);
+    if (server_instance > 0)
+        name += ".instance" + std::to_string(server_instance);
+    return name;
+}
+
+int run_driver(coverage_map& shm, std::vector<Input>& inputs);
+pid_t run_server();
+
+// Mutates a field that names a structure-aware mutator of the driver with
+// its "mutator" key. Returns false for mutators the driver does not have,
+// those fields go through the byte mutators instead.
+bool mutate_structured(const Field& format, std::vector<std::byte>& data);
+
+// How start_server() tells that the server started by run_server() is ready
+ServerProbe server_probe();
\ No newline at end of file
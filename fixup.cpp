@@ -0,0 +1,41 @@
+#include "fixup.h"
+#include <cstdint>
+#include "checksum.h"
+
+static void write_value(const Field& format, uint64_t value,
+                        std::vector<std::byte>& data) {
+    const unsigned int width = format.maxLen;
+    data.resize(width);
+    for (unsigned int i = 0; i < width; i++) {
+        unsigned int shift = 8 * (format.littleEndian ? i : width - 1 - i);
+        data[i] = static_cast<std::byte>(value >> shift);
+    }
+}
+
+void fixup_seed(InputSeed& seed) {
+    for (auto& elem : seed.inputs) {
+        if (elem.data.size() > elem.format->clampTo)
+            elem.data.resize(elem.format->clampTo);
+    }
+
+    for (auto kind : {FieldFixup::LENGTH_OF, FieldFixup::CRC_OF}) {
+        for (auto& elem : seed.inputs) {
+            const Field& format = *elem.format;
+            if (format.fixup != kind)
+                continue;
+
+            uint64_t length = 0;
+            uint16_t crc = CRC_START_16;
+            for (unsigned int source : format.fixupSources) {
+                const auto& data = seed.inputs[source].data;
+                length += data.size();
+                if (kind == FieldFixup::CRC_OF) {
+                    for (std::byte b : data)
+                        crc = update_crc_16(crc, std::to_integer<uint8_t>(b));
+                }
+            }
+            write_value(format, kind == FieldFixup::LENGTH_OF ? length : crc,
+                        elem.data);
+        }
+    }
+}
@@ -0,0 +1,12 @@
+#pragma once
+#include "inputs.h"
+
+/**
+ * @brief Makes a mutated seed consistent again, as declared in the config:
+ * fields with "clamp_to" are cut to that length, then fields with
+ * "length_of" get the total length of their source fields and fields with
+ * "crc_of" the CRC-16 of them. CRCs come last, so they cover the fixed
+ * lengths. Computed values take max_length bytes, big endian unless the
+ * field sets "little_endian".
+*/
+void fixup_seed(InputSeed& seed);
@@ -0,0 +1,114 @@
+"""
+Shared memory coverage channel between the Python servers and the fuzzer.
+
+The fuzzer maps a POSIX shared memory segment as its coverage map and
+announces it through the __FUZZ_SHM_ID environment variable, like AFL's
+__AFL_SHM_ID. Instead of saving a coverage.py database after every request,
+the servers record the line transitions (arcs) they take straight into that
+map. Works with both Python 2 (CoAPthon) and Python 3.
+"""
+import ctypes
+import mmap
+import os
+import sys
+import threading
+import zlib
+
+SHM_ENV = "__FUZZ_SHM_ID"
+MAP_SIZE = 65536
+
+
+def enabled():
+    """Whether the fuzzer handed us a shared memory coverage map"""
+    return bool(os.environ.get(SHM_ENV))
+
+
+class ShmCoverage(object):
+    """
+    Drop-in replacement for coverage.Coverage as used by the servers: arcs
+    between start() and stop() are counted in the shared map, and erase()
+    and save() are no-ops since the fuzzer clears the map itself and there
+    is nothing left to write out.
+    """
+
+    def __init__(self, root):
+        """
+        :param root: only code below this directory is traced
+        """
+        name = os.environ[SHM_ENV].lstrip("/")
+        fd = os.open(os.path.join("/dev/shm", name), os.O_RDWR)
+        size = os.fstat(fd).st_size
+        self._mm = mmap.mmap(fd, size)
+        os.close(fd)
+
+        # The fuzzer can be built with 16 bit counters, see driver.h
+        if size == 2 * MAP_SIZE:
+            self._counters = (ctypes.c_uint16 * MAP_SIZE).from_buffer(self._mm)
+            self._max = 0xFFFF
+        else:
+            self._counters = (ctypes.c_uint8 * MAP_SIZE).from_buffer(self._mm)
+            self._max = 0xFF
+
+        self._root = os.path.abspath(root)
+        self._file_ids = {}
+        self._active = False
+
+    def start(self):
+        self._active = True
+        threading.settrace(self._trace_call)
+        sys.settrace(self._trace_call)
+
+    def stop(self):
+        # Threads that are still running notice this on their next event
+        self._active = False
+        sys.settrace(None)
+        threading.settrace(None)
+
+    def erase(self):
+        pass
+
+    def save(self):
+        pass
+
+    def _file_id(self, filename):
+        """Stable id of a source file, or None if it shouldn't be traced"""
+        try:
+            return self._file_ids[filename]
+        except KeyError:
+            path = os.path.abspath(filename)
+            fid = None
+            if path.startswith(self._root) and "site-packages" not in path:
+                fid = zlib.crc32(path.encode("utf-8")) & 0xFFFFFFFF
+            self._file_ids[filename] = fid
+            return fid
+
+    def _hit(self, fid, src, dst):
+        # Tuples of ints hash the same way in every process
+        idx = hash((fid, src, dst)) & (MAP_SIZE - 1)
+        count = self._counters[idx]
+        if count < self._max:
+            self._counters[idx] = count + 1
+
+    def _trace_call(self, frame, event, arg):
+        if not self._active:
+            return None
+        fid = self._file_id(frame.f_code.co_filename)
+        if fid is None:
+            return None
+
+        # Like coverage.py, entering and leaving a code object are arcs from
+        # and to its negated first line
+        entry = -frame.f_code.co_firstlineno
+        last = [entry]
+
+        def trace_line(frame, event, arg):
+            if not self._active:
+                return None
+            if event == "line":
+                self._hit(fid, last[0], frame.f_lineno)
+                last[0] = frame.f_lineno
+            elif event == "return":
+                self._hit(fid, last[0], entry)
+            return trace_line
+
+        return trace_line
@@ -1,19 +1,28 @@
+#include <getopt.h>  // For getopt_long()
 #include <stdio.h>
-#include <sys/wait.h>  // For waitpid()
 #include <unistd.h>    // For fork(), execvp()
 #include <array>
 #include <chrono>
+#include <csignal>
 #include <cstring>
 #include <filesystem>
 #include <fstream>  // ifstream
+#include <functional>
 #include <iostream>
-#include <queue>
-#include <random>
 
+#include "alloc_count.h"
 #include "config.h"
+#include "corpus.h"
+#include "coverage.h"
 #include "driver.h"
+#include "fixup.h"
 #include "inputs.h"
+#include "operators.h"
+#include "power.h"
+#include "rng.h"
 #include "sample_program.h"
+#include "scheduler.h"
+#include "shm.h"
 
 #define STRINGIFY(x) #x
 #define GETENV(x) STRINGIFY(x)
@@ -21,15 +30,14 @@
 namespace fs = std::filesystem;
 const std::string program_name = GETENV(PROGRAM_NAME);
 const std::string output_dir = program_name + "_out";
-const fs::path output_directory{output_dir};
+fs::path output_directory{output_dir};
 
 static int8_t interesting_8[] = {INTERESTING_8};
 static int16_t interesting_16[] = {INTERESTING_8, INTERESTING_16};
 static int32_t interesting_32[] = {INTERESTING_8, INTERESTING_16,
                                    INTERESTING_32};
-void fuzz(std::vector<std::byte>& fuzz_data, int minLen, int maxLen);
-void fuzz_set(std::vector<std::byte>& fuzz_data,
-              const std::vector<std::byte>& valid_set, int minLen, int maxLen);
+void fuzz(std::vector<std::byte>& fuzz_data, const Field& format);
+void fuzz_set(std::vector<std::byte>& fuzz_data, const Field& format);
 
 // Change endianness of a 16 bit value
 uint16_t SWAP16(uint16_t _x) {
@@ -44,23 +52,28 @@ uint32_t SWAP32(uint32_t _x) {
                       ((_ret >> 8) & 0x0000FF00));
 }
 
-template <typename T>
-T random_int(T min, T max) {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    std::uniform_int_distribution<T> dis(min, max);
-    return dis(gen);
-}
+void mutateSeed(const InputSeed& seed, InputSeed& mutated);
+bool spliceSeeds(const InputSeed& seed, const InputSeed& other,
+                 InputSeed& spliced);
+// Runs an input and returns the checksum of its coverage. The flag marks the
+// run of the unmutated seed.
+typedef std::function<uint32_t(const InputSeed&, bool)> seed_runner;
+size_t deterministic_stages(const InputSeed& seed, InputSeed& mutated,
+                            const seed_runner& run);
+size_t trim_seed(InputSeed& seed, InputSeed& trial, const seed_runner& run);
+bool isInteresting(coverage_map& data, bool failed);
 
-std::vector<Input> makeInputsFromSeed(const InputSeed& seed);
-InputSeed mutateSeed(InputSeed seed);
-bool isInteresting(std::array<char, SIZE>& data, bool failed);
-void assignEnergy(InputSeed& input, int seed_count);
+// Copy of the block the repeated clones are taken from, as they overwrite
+// it. Blocks are at most HAVOC_BLK_XL bytes, so this never grows.
+static std::vector<std::byte> clone_block;
+
+// Tokens found by the byte flips of this worker, by field index
+static std::vector<TokenTable> auto_tokens;
 
 uint32_t rand32(uint32_t limit) {
     if (limit <= 1)
         return 0;
-    return random_int<uint32_t>(0, limit - 1);
+    return rng.below(limit);
 }
 
 void FLIP_BIT(std::byte* data_array, uint32_t bit_index) {
@@ -110,121 +123,341 @@ static uint32_t choose_block_len(uint32_t limit) {
     return min_value + rand32(max_value - min_value + 1);
 }
 
-int main() {
-    // Initialise the coverage measurement buffer
-    std::array<char, SIZE> coverage_arr{};
+// Bucket maps of the branch counts seen so far, see isInteresting(). They live
+// in shared memory so that all workers agree on what is new.
+char* failed_tracking = nullptr;
+char* good_tracking = nullptr;
+int worker_id = 0;
+
+// Whether the Python servers save their coverage to a coverage.py database
+// instead of writing it straight into the shared coverage map
+bool sqlite_coverage = false;
+
+bool persistent_session = false;
+
+// Whether to go straight to the random stages, like AFL's -d
+bool skip_deterministic = false;
+
+// Percentage of havoc runs that go out without the fix-ups of the config,
+// to see how the target copes with inconsistent fields
+unsigned int fixup_skip = FIXUP_SKIP_PERC;
+
+// Seed of the mutators, workers add their index to it
+uint64_t rng_seed = 0;
+RngKind rng_kind = RngKind::XOSHIRO256;
+
+void fuzz_loop(SeedStore& corpus, const PowerConfig& power_config);
+bool check_allocations(const SeedStore& corpus, unsigned int runs);
+
+void usage(const char* argv0) {
+    std::cerr << "Usage: " << argv0 << " [-j <workers>] [--standby <servers>] [--sqlite-coverage] [--persistent]"
+              << " [--seed <n>] [--rng xoshiro256|wyrand] [-d] [--fixup-skip <percent>]"
+              << " [--alloc-check <runs>]" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    int workers = 1;
+    bool seeded = false;
+    unsigned int alloc_check_runs = 0;
+    const struct option long_options[] = {
+        {"workers", required_argument, nullptr, 'j'},
+        {"sqlite-coverage", no_argument, nullptr, 's'},
+        {"persistent", no_argument, nullptr, 'p'},
+        {"standby", required_argument, nullptr, 'k'},
+        {"seed", required_argument, nullptr, 'r'},
+        {"rng", required_argument, nullptr, 'g'},
+        {"skip-deterministic", no_argument, nullptr, 'd'},
+        {"fixup-skip", required_argument, nullptr, 'f'},
+        {"alloc-check", required_argument, nullptr, 'a'},
+        {nullptr, 0, nullptr, 0}};
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:d", long_options, nullptr)) != -1) {
+        switch (opt) {
+            case 'j':
+                workers = atoi(optarg);
+                break;
+            case 's':
+                sqlite_coverage = true;
+                break;
+            case 'p':
+                persistent_session = true;
+                break;
+            case 'k':
+                standby_servers = atoi(optarg);
+                break;
+            case 'r':
+                rng_seed = strtoull(optarg, nullptr, 0);
+                seeded = true;
+                break;
+            case 'd':
+                skip_deterministic = true;
+                break;
+            case 'f':
+                fixup_skip = atoi(optarg);
+                break;
+            case 'a':
+                alloc_check_runs = atoi(optarg);
+                break;
+            case 'g':
+                if (!parse_rng_kind(optarg, rng_kind)) {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (workers < 1 || workers > INSTANCE_PORT_STRIDE || standby_servers < 0 ||
+        fixup_skip > 100) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!seeded)
+        rng_seed = random_seed();
+    printf("Random seed %llu, rerun with --seed to repeat the mutations\n",
+           static_cast<unsigned long long>(rng_seed));
 
-    // Initialise the seed queue
-    std::queue<InputSeed> seedQueue;
 
     // Read the config file
     std::ifstream file{config_file};
     const json config = json::parse(file);
-    std::vector<Field> fields = readFields(config);
+    // Seeds point into the fields, they stay unchanged until the end
+    const std::vector<Field> fields = readFields(config);
+    auto_tokens.resize(fields.size());
+    const PowerConfig power_config = readPowerConfig(config);
+
+    // Initialise the corpus, the scheduler of each worker goes round it
+    SeedStore corpus(fields);
     if (!config.contains("seed_folder")) {
         throw std::runtime_error(
             "Config file does not contain a seed folder path");
     }
     const fs::path seed_folder{config["seed_folder"]};
 
+    // Read the seed file
+    for (auto const& seed_file : fs::directory_iterator{seed_folder}) {
+        std::ifstream seed{seed_file.path()};
+        json seed_json = json::parse(seed);
+        InputSeed seed_input = readSeed(seed_json, fields);
+
+        corpus.add(seed_input);
+    }
+
+    // Only checks the mutations for allocations, without servers
+    if (alloc_check_runs > 0) {
+        rng.seed(rng_seed, rng_kind);
+        return check_allocations(corpus, alloc_check_runs) ? 0 : 1;
+    }
+
+    catch_stop_signals();
+
+    // Both bucket maps are kept in one region, failures first
+    const std::string tracking_shm_name =
+        "/fuzz_" + program_name + "_" + std::to_string(getpid()) + "_tracking";
+    auto tracking = static_cast<char*>(
+        create_shared_region(tracking_shm_name, 2 * SIZE));
+    failed_tracking = tracking;
+    good_tracking = tracking + SIZE;
+
+    if (workers == 1) {
+        fuzz_loop(corpus, power_config);
+        remove_shared_region(tracking_shm_name);
+        return 0;
+    }
+
+    // Every worker fuzzes the whole seed folder against its own server and
+    // writes its results into its own subfolder of the output directory.
+    std::vector<pid_t> worker_pids;
+    for (int w = 0; w < workers; w++) {
+        pid_t pid = fork();
+        if (pid == -1) {
+            std::cerr << "Failed to fork worker " << w << std::endl;
+            break;
+        } else if (pid == 0) {
+            worker_id = w;
+            output_directory /= "worker" + std::to_string(w);
+            // The first worker walks the starting seeds deterministically,
+            // like AFL's main instance, the others go straight to havoc
+            if (w != 0) {
+                for (uint32_t id = 0; id < corpus.size(); id++)
+                    corpus.info(id).deterministic_done = true;
+            }
+            fuzz_loop(corpus, power_config);
+            fflush(stdout);
+            _exit(0);
+        }
+        worker_pids.push_back(pid);
+    }
+    printf("Started %zu workers\n", worker_pids.size());
+
+    wait_for_workers(worker_pids);
+    remove_shared_region(tracking_shm_name);
+    return 0;
+}
+
+/**
+ * @brief Creates the coverage map of this worker in shared memory. Unless the
+ * SQLite fallback is used, the Python servers are told about it through the
+ * environment and write their coverage straight into it.
+*/
+static std::string coverage_shm_name;
+
+coverage_map& create_coverage_map() {
+    coverage_shm_name =
+        "/fuzz_" + program_name + "_" + std::to_string(getpid()) + "_cov";
+    auto map = static_cast<coverage_map*>(
+        create_shared_region(coverage_shm_name, sizeof(coverage_map)));
+    // For a worker that gives up on its server, fuzz_loop() removes the map
+    // when it is stopped
+    std::atexit([] { remove_shared_region(coverage_shm_name); });
+
+    if (!sqlite_coverage) {
+        setenv(COVERAGE_SHM_ENV, coverage_shm_name.c_str(), 1);
+
+        // Let the servers import fuzz_coverage.py from here
+        std::string pythonpath = fs::current_path().string();
+        if (getenv("PYTHONPATH"))
+            pythonpath += ":" + std::string(getenv("PYTHONPATH"));
+        setenv("PYTHONPATH", pythonpath.c_str(), 1);
+    }
+    return *map;
+}
+
+void fuzz_loop(SeedStore& corpus, const PowerConfig& power_config) {
+    rng.seed(rng_seed + worker_id, rng_kind);
+
+    // Initialise the coverage measurement buffer
+    coverage_map& coverage_arr = create_coverage_map();
+
     // Create output folder
     fs::create_directories(output_directory / "interesting");
     fs::create_directories(output_directory / "crash");
+    schedule.init(corpus.fields(), output_directory / "operators");
 
     // Create time file and clear its contents
     std::ofstream tfile{output_directory / "time", std::ios::trunc};
     std::ofstream efile{output_directory / "effi", std::ios::trunc};
+    std::ofstream sfile{output_directory / "server", std::ios::trunc};
     tfile.close();
     efile.close();
 
-    // Read the seed file
-    for (auto const& seed_file : fs::directory_iterator{seed_folder}) {
-        std::ifstream seed{seed_file.path()};
-        json seed_json = json::parse(seed);
-        InputSeed seed_input = readSeed(seed_json, fields);
-
-        seedQueue.push(seed_input);
-    }
-
-    // Run the coverage Python script to generate the .coverage file
-    // This is a stand-in for the actual server, and is just listening for connections on 4345.
-    pid_t pid = run_server();
+    // Start the server and wait until it answers its readiness probe
+    auto server_start_time = std::chrono::steady_clock::now();
+    pid_t pid = start_server();
+    sfile << "S,0,"
+          << std::chrono::duration_cast<std::chrono::microseconds>(
+                 std::chrono::steady_clock::now() - server_start_time)
+                 .count()
+          << std::endl;
+    sfile.close();
+    coverage_arr.fill(0);  // Drop what the probe covered
     printf("Server started\n");
-    sleep(
-        5);  // Wait for the server to start, on actual should probably use a signal or something
+    printf("Using %s coverage kernel\n", coverage_kernel_name());
 
     unsigned int interesting_count = 0;
     unsigned int crash_count = 0;
-    auto startTime = std::chrono::system_clock::now();
-    auto startMillisecondsSinceEpoch =
-        std::chrono::time_point_cast<std::chrono::milliseconds>(startTime)
-            .time_since_epoch()
+    // Times are taken from the steady clock, which wall clock adjustments do
+    // not move. The time and server files log milliseconds since the start,
+    // the effi file microseconds.
+    using clock = std::chrono::steady_clock;
+    const auto start_time = clock::now();
+    auto ms_since_start = [&]() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+                   clock::now() - start_time)
             .count();
-
-    while (true) {
-        InputSeed i = seedQueue.front();
-        assignEnergy(i, seedQueue.size());
-        seedQueue.pop();
-
-        auto seed_start_time =
-            std::chrono::time_point_cast<std::chrono::milliseconds>(
-                std::chrono::system_clock::now())
-                .time_since_epoch()
-                .count();
+    };
+    auto us_since = [](clock::time_point from) {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+                   clock::now() - from)
+            .count();
+    };
+
+    // Reused for every seed and execution, see mutateSeed()
+    InputSeed current;
+    InputSeed mutated;
+    InputSeed other;
+    InputSeed spliced;
+    std::vector<Input> inputs;
+    // Coverage map entries and run time of the last execution, kept for the
+    // scheduler when the input is queued
+    std::vector<uint32_t> trace;
+    uint32_t exec_us = 0;
+
+    SeedScheduler scheduler(corpus);
+    PowerSchedule power(power_config);
+    // Fuzzing is usually stopped with Ctrl-C, which ends the loop after the
+    // current input so that the servers and the map are cleaned up
+    while (!stop_requested) {
+        uint32_t id = scheduler.next();
+        corpus.load(id, current);
+
+        const auto seed_start_time = clock::now();
         auto seed_interesting_count = 0;
         auto seed_crash_count = 0;
         int64_t mutation_time = 0;
         int64_t driver_time = 0;
-
-        for (int j = 0; j < i.energy; j++) {
-            auto mutation_start_time =
-                std::chrono::time_point_cast<std::chrono::milliseconds>(
-                    std::chrono::system_clock::now())
-                    .time_since_epoch()
-                    .count();
-            InputSeed mutated = mutateSeed(i);
-            std::vector<Input> inputs = makeInputsFromSeed(mutated);
-
-            auto mutation_end_time =
-                std::chrono::time_point_cast<std::chrono::milliseconds>(
-                    std::chrono::system_clock::now())
-                    .time_since_epoch()
-                    .count();
-            // Run the driver a few times
+        size_t mutation_allocations = 0;
+        // Runs of the seed and its mutants in this pass, for its average
+        // exec time
+        uint64_t pass_exec_us = 0;
+        uint32_t pass_runs = 0;
+
+        // Runs one input and times it, its coverage is left in the map.
+        // Once the fuzzer is stopped nothing is run, so that the stages of
+        // the seed run out quickly.
+        auto run_input = [&](const InputSeed& input) {
+            if (stop_requested)
+                return false;
+            makeInputsFromSeed(input, inputs);
+
+            const auto run_start = clock::now();
             bool failed = run_driver(coverage_arr, inputs);
-
-            auto driver_end_time =
-                std::chrono::time_point_cast<std::chrono::milliseconds>(
-                    std::chrono::system_clock::now())
-                    .time_since_epoch()
-                    .count();
-            mutation_time += mutation_end_time - mutation_start_time;
-            driver_time += driver_end_time - mutation_end_time;
-
-            if (failed) {
-                kill(pid, SIGTERM);
-                pid = run_server();
-                sleep(5);  // Wait for the server to start, on actual should probably use a signal or something
-            }
-            if (isInteresting(coverage_arr, failed)) {
-                seedQueue.emplace(mutated);
-                std::cout << "Interesting: " << mutated.to_json() << std::endl;
+            exec_us = us_since(run_start);
+            driver_time += exec_us;
+            pass_exec_us += exec_us;
+            pass_runs++;
+            return failed;
+        };
+
+        // Replaces the server after a failed input and logs whether it
+        // crashed or hung and how long it took to get a new one ready
+        auto replace_server = [&]() {
+            auto restart = restart_server(pid);
+            coverage_arr.fill(0);  // Drop what the probe covered
+
+            std::ofstream server_file{output_directory / "server",
+                                      std::ios::app};
+            server_file << (restart.failure == ServerFailure::CRASH ? "C"
+                                                                    : "H")
+                        << "," << ms_since_start() << ","
+                        << restart.latency_us << std::endl;
+        };
+
+        // Runs one input and records what it found. Returns the checksum of
+        // its coverage, which the deterministic stages compare against the
+        // unmutated seed. A calibration run only records the coverage, the
+        // input is already in the queue.
+        auto execute = [&](const InputSeed& input, bool calibration) {
+            bool failed = run_input(input);
+            uint32_t cksum = coverage_trace(coverage_arr, trace);
+            power.count_run(cksum, exec_us);
+            if (isInteresting(coverage_arr, failed) && !calibration) {
+                uint32_t new_id = corpus.add(input);
+                scheduler.calibrate(new_id, trace, cksum, exec_us);
+                std::cout << "Interesting: " << input.to_json() << std::endl;
 
                 // Output interesting input as a file in the output directory
                 std::ostringstream filename;
                 std::ofstream time_file{output_directory / "time",
                                         std::ios::app};
                 fs::path output_path;
-                auto currentTime = std::chrono::system_clock::now();
-                auto millisecondsSinceEpoch =
-                    std::chrono::time_point_cast<std::chrono::milliseconds>(
-                        currentTime)
-                        .time_since_epoch()
-                        .count();
-                auto timeSinceStart =
-                    millisecondsSinceEpoch - startMillisecondsSinceEpoch;
+                auto timeSinceStart = ms_since_start();
 
                 if (failed) {
+                    // Crashes are left as they were found, for the bug checkers
+                    corpus.info(new_id).trim_done = true;
                     seed_crash_count++;
                     filename << "input" << crash_count << ".json";
                     output_path = output_directory / "crash" / filename.str();
@@ -232,6 +465,7 @@ int main() {
                     crash_count++;
                 } else {
                     seed_interesting_count++;
+                    corpus.info(new_id).file = interesting_count;
                     filename << "input" << interesting_count << ".json";
                     output_path =
                         output_directory / "interesting" / filename.str();
@@ -239,143 +473,705 @@ int main() {
                     interesting_count++;
                 }
                 std::ofstream output_file{output_path};
-                output_file << std::setw(4) << mutated.to_json() << std::endl;
+                output_file << std::setw(4) << input.to_json() << std::endl;
                 output_file.close();
                 time_file.close();
             }
 
-            // Zero out the coverage array
-            for (auto& elem : coverage_arr) {
-                elem = 0;
-            }
-
-            // /* If we're finding new stuff, let's run for a bit longer, limits
-            // permitting. */
+            if (failed)
+                replace_server();
+            return cksum;
+        };
+
+        // Runs a trim attempt. Like in AFL's trim_case(), only its checksum
+        // is compared and the map is cleared without being classified:
+        // classifying would mark what the attempt covered as seen by every
+        // worker, while the attempt itself is never queued.
+        auto trim_run = [&](const InputSeed& input, bool) {
+            bool failed = run_input(input);
+            uint32_t cksum = coverage_trace(coverage_arr, trace);
+            power.count_run(cksum, exec_us);
+            coverage_arr.fill(0);
+            if (failed)
+                replace_server();
+            return cksum;
+        };
+
+        // Starting seeds are run once for the scheduler, queued ones were
+        // calibrated by the run that found them
+        if (!corpus.info(id).calibrated) {
+            uint32_t cksum = execute(current, true);
+            scheduler.calibrate(id, trace, cksum, exec_us);
+            pass_exec_us = 0;
+            pass_runs = 0;
+        }
 
-            // if (queued_paths != havoc_queued) {
+        // Adding seeds moves the infos, so keep no reference across the loop
+        const unsigned int energy = power.energy(corpus, id);
+        corpus.info(id).energy = energy;
+
+        // Seeds are trimmed once, on their first pass, so that none of their
+        // descendants pays for bytes that do not change the coverage
+        if (!corpus.info(id).trim_done) {
+            corpus.info(id).trim_done = true;
+            const uint32_t size = corpus.info(id).size;
+            auto runs = trim_seed(current, mutated, trim_run);
+            uint32_t trimmed_size = 0;
+            for (const auto& elem : current.inputs)
+                trimmed_size += elem.data.size();
+            // Attempts that were not run would all look the same
+            if (trimmed_size < size && !stop_requested) {
+                corpus.shrink(id, current);
+                scheduler.resized(id);
+                const int32_t file = corpus.info(id).file;
+                if (file >= 0) {
+                    std::ofstream output_file{
+                        output_directory / "interesting" /
+                        ("input" + std::to_string(file) + ".json")};
+                    output_file << std::setw(4) << current.to_json()
+                                << std::endl;
+                }
+            }
+            printf("Trimmed seed %u from %u to %u bytes in %zu runs\n", id,
+                   size, trimmed_size, runs);
+        }
 
-            //   if (perf_score <= HAVOC_MAX_MULT * 100) {
-            //     stage_max  *= 2;
-            //     perf_score *= 2;
-            //   }
+        // Seeds get the deterministic stages once, on their first pass
+        if (!skip_deterministic && !corpus.info(id).deterministic_done) {
+            corpus.info(id).deterministic_done = true;
+            auto runs = deterministic_stages(
+                current, mutated, [&](const InputSeed& input, bool calibration) {
+                    return execute(input, calibration);
+                });
+            printf("Deterministic stages of seed %u: %zu runs\n", id, runs);
+        }
 
-            //   havoc_queued = queued_paths;
+        // Runs havoc on a parent, the seed itself or a splice of it.
+        // Returns how long the mutation and its run took.
+        unsigned int havoc_runs = 0;
+        auto havoc = [&](const InputSeed& parent) {
+            const auto mutation_start_time = clock::now();
+            auto allocations = heap_allocations();
+            mutateSeed(parent, mutated);
+            if (rand32(100) >= fixup_skip)
+                fixup_seed(mutated);
+            mutation_allocations += heap_allocations() - allocations;
+            mutation_time += us_since(mutation_start_time);
+
+            // The operators of the mutation are credited if it was queued
+            size_t queued = corpus.size();
+            execute(mutated, false);
+            schedule.reward(corpus.size() > queued);
+            havoc_runs++;
+            return us_since(mutation_start_time);
+        };
+
+        // Havoc and splicing stop early once the seed is out of time
+        const auto havoc_start = clock::now();
+        auto out_of_time = [&]() {
+            return stop_requested ||
+                   (power_config.max_seed_ms > 0 &&
+                    clock::now() - havoc_start >=
+                        std::chrono::milliseconds(power_config.max_seed_ms));
+        };
+
+        // Spends `runs` of the seed's energy on a parent. With time energy
+        // that is as long as `runs` average runs of the whole fuzzer take,
+        // so a slow seed gets fewer runs and a fast one more, up to
+        // max_energy.
+        auto havoc_stage = [&](const InputSeed& parent, unsigned int runs) {
+            if (!power_config.time_energy) {
+                for (unsigned int j = 0; j < runs && !out_of_time(); j++)
+                    havoc(parent);
+                return;
+            }
+            const uint64_t budget_us = runs * power.average_exec_us();
+            uint64_t spent_us = 0;
+            for (unsigned int j = 0; j < power_config.max_energy &&
+                                     spent_us < budget_us && !out_of_time();
+                 j++)
+                spent_us += havoc(parent);
+        };
+
+        havoc_stage(current, energy);
+
+        // /* If we're finding new stuff, let's run for a bit longer, limits
+        // permitting. */
+
+        // if (queued_paths != havoc_queued) {
+
+        //   if (perf_score <= HAVOC_MAX_MULT * 100) {
+        //     stage_max  *= 2;
+        //     perf_score *= 2;
+        //   }
+
+        //   havoc_queued = queued_paths;
+
+        // Splice stage: cross the seed with other seeds of the queue and run
+        // havoc on the results, with as many runs again as its energy
+        const unsigned int splice_cycles =
+            corpus.size() > 1 ? std::min(energy, SPLICE_CYCLES) : 0;
+        for (unsigned int cycle = 0; cycle < splice_cycles && !out_of_time();
+             cycle++) {
+            uint32_t other_id = rand32(corpus.size() - 1);
+            if (other_id >= id)
+                other_id++;
+            corpus.load(other_id, other);
+            if (!spliceSeeds(current, other, spliced))
+                continue;
+            havoc_stage(spliced, energy / splice_cycles);
         }
 
-        auto seed_finish_time =
-            std::chrono::time_point_cast<std::chrono::milliseconds>(
-                std::chrono::system_clock::now())
-                .time_since_epoch()
-                .count();
         std::ofstream effi_file{output_directory / "effi", std::ios::app};
-        effi_file << seed_finish_time - seed_start_time << "," << i.energy
+        effi_file << us_since(seed_start_time) << "," << havoc_runs
                   << "," << seed_interesting_count << "," << seed_crash_count
                   << "," << mutation_time << "," << driver_time << std::endl;
         effi_file.close();
+#ifdef COUNT_ALLOCATIONS
+        // Only a new largest input should make the buffers grow
+        if (mutation_allocations > 0) {
+            std::cerr << "Mutations of seed allocated " << mutation_allocations
+                      << " times" << std::endl;
+        }
+#endif
 
-        seedQueue.emplace(i);
+        scheduler.timed(id, pass_exec_us, pass_runs);
+        scheduler.fuzzed(id);
+        tend_servers();
     }
-    kill(pid, SIGTERM);  // Kill the Python server
+    stop_all_servers();
+    remove_shared_region(coverage_shm_name);
+    printf("Stopped\n");
 }
 
-bool isInteresting(std::array<char, SIZE>& data, bool failed) {
-    // This is a mirror of the array produced by the coverage tool
+/**
+ * @brief Mutates every seed of the corpus as havoc does, without running the
+ * mutants, and counts the heap allocations of the mutations and fix-ups.
+ * Each mutation is first made uncounted, which lets the reused buffers grow
+ * to fit it, and then made again from the same random state, which must not
+ * allocate.
+ *
+ * @return Whether none of the repeated mutations allocated.
+*/
+bool check_allocations(const SeedStore& corpus, unsigned int runs) {
+#ifndef COUNT_ALLOCATIONS
+    std::cerr << "Allocations are only counted in builds with COUNT_ALLOCS=1"
+              << std::endl;
+    return false;
+#endif
+    schedule.init(corpus.fields(), "");
+    InputSeed current;
+    InputSeed mutated;
+    size_t allocations = 0;
+    for (uint32_t id = 0; id < corpus.size(); id++) {
+        corpus.load(id, current);
+        for (unsigned int i = 0; i < runs; i++) {
+            const Rng start = rng;
+            for (bool counted : {false, true}) {
+                rng = start;
+                auto before = heap_allocations();
+                mutateSeed(current, mutated);
+                if (rand32(100) >= fixup_skip)
+                    fixup_seed(mutated);
+                if (counted)
+                    allocations += heap_allocations() - before;
+            }
+        }
+    }
+    printf("%u mutations of each of %zu seeds allocated %zu times\n", runs,
+           corpus.size(), allocations);
+    return allocations == 0;
+}
+
+bool isInteresting(coverage_map& data, bool failed) {
+    // The tracking maps mirror the array produced by the coverage tool
     // to track which branches have been taken
 
     // Each char element contains the bucket count of the number of times
     // a branch has been taken.
     // Separate bucket for failures and succeeds
-    static char* failed_tracking = new char[SIZE]();
-    static char* good_tracking = new char[SIZE]();
-
     auto tracking = failed ? failed_tracking : good_tracking;
 
-    // Bucketing branch transition counts
-    bool is_interesting = false;
-    for (int i = 0; i < SIZE; i++) {
-        if (data[i] >= 128 && tracking[i] >> 7 == 0) {
-            tracking[i] |= 0b10000000;
-            // std::cout << "new path: " << i << std::endl;
-            is_interesting = true;
-        } else if (data[i] >= 32 && (tracking[i] >> 6) % 2 == 0) {
-            tracking[i] |= 0b01000000;
-            // std::cout << "new path: " << i << std::endl;
-            is_interesting = true;
-        } else if (data[i] >= 16 && (tracking[i] >> 5) % 2 == 0) {
-            tracking[i] |= 0b00100000;
-            // std::cout << "new path: " << i << std::endl;
-            is_interesting = true;
-        } else if (data[i] >= 8 && (tracking[i] >> 4) % 2 == 0) {
-            tracking[i] |= 0b00010000;
-            // std::cout << "new path: " << i << std::endl;
-            is_interesting = true;
-        } else if (data[i] >= 4 && (tracking[i] >> 3) % 2 == 0) {
-            tracking[i] |= 0b00001000;
-            // std::cout << "new path: " << i << std::endl;
-            is_interesting = true;
-        } else if (data[i] == 3 && (tracking[i] >> 2) % 2 == 0) {
-            tracking[i] |= 0b00000100;
-            // std::cout << "new path: " << i << std::endl;
-            is_interesting = true;
-        } else if (data[i] == 2 && (tracking[i] >> 1) % 2 == 0) {
-            tracking[i] |= 0b00000010;
-            // std::cout << "new path: " << i << std::endl;
-            is_interesting = true;
-        } else if (data[i] == 1 && tracking[i] % 2 == 0) {
-            tracking[i] |= 0b00000001;
-            // std::cout << "new path: " << i << std::endl;
-            is_interesting = true;
+    // Bucketing branch transition counts. This also zeroes the coverage array
+    // for the next run.
+    return classify_and_reset(data, tracking);
+}
+
+/**
+ * @brief Mutates a seed into a reused one, which keeps its buffers from
+ * the previous mutation instead of allocating new ones.
+*/
+void mutateSeed(const InputSeed& seed, InputSeed& mutated) {
+    mutated.inputs.resize(seed.inputs.size());
+    for (size_t i = 0; i < seed.inputs.size(); i++) {
+        auto& elem = mutated.inputs[i];
+        const Field& format = *seed.inputs[i].format;
+        elem.format = &format;
+        if (!format.validChoices.empty()) {
+
+            // if there are a set of valid choices, pick a random one to be the next input
+            auto& choice =
+                format.validChoices[rand32(format.validChoices.size())];
+            elem.data.assign(choice.begin(), choice.end());
+            continue;
+        }
+
+        elem.data.assign(seed.inputs[i].data.begin(),
+                         seed.inputs[i].data.end());
+        if (!format.mutator.empty() && mutate_structured(format, elem.data)) {
+            continue;
+        } else if (format.validSet.size() > 0) {
+            // If there is a valid set, use it to mutate the input
+            fuzz_set(elem.data, format);
+        } else {
+
+            // Otherwise, put it through the mutation process.
+            fuzz(elem.data, format);
+        }
+    }
+}
+
+/**
+ * @brief Crosses a seed with another one of the queue, field by field. Every
+ * field where the two differ is kept, taken whole from the other seed, or
+ * cut at a point between the first and last byte where they differ, the
+ * head coming from the seed and the tail from the other. Fields with valid
+ * choices are left alone, mutateSeed() picks a new choice for them anyway.
+ *
+ * @return Whether the result differs from the seed, it does not if the two
+ * only differ in fields with valid choices.
+*/
+bool spliceSeeds(const InputSeed& seed, const InputSeed& other,
+                 InputSeed& spliced) {
+    spliced.inputs.resize(seed.inputs.size());
+    bool changed = false;
+    // Field to fall back to if no field is picked from the other seed
+    int last_diff = -1;
+
+    for (size_t i = 0; i < seed.inputs.size(); i++) {
+        const auto& a = seed.inputs[i].data;
+        const auto& b = other.inputs[i].data;
+        auto& elem = spliced.inputs[i];
+        elem.format = seed.inputs[i].format;
+        elem.data.assign(a.begin(), a.end());
+
+        if (!elem.format->validChoices.empty() || a == b)
+            continue;
+        last_diff = i;
+
+        switch (rand32(3)) {
+            case 0:
+                break;
+            case 1:
+                elem.data.assign(b.begin(), b.end());
+                changed = true;
+                break;
+            case 2: {
+                // First and last differing byte within the shorter of the two
+                // (AFL's locate_diffs())
+                size_t common = std::min(a.size(), b.size());
+                size_t f_diff = 0;
+                while (f_diff < common && a[f_diff] == b[f_diff])
+                    f_diff++;
+                size_t l_diff = common;
+                while (l_diff > f_diff && a[l_diff - 1] == b[l_diff - 1])
+                    l_diff--;
+
+                // Without two differing bytes the cut gives one of the two
+                size_t split_at = f_diff;
+                if (l_diff - f_diff >= 2)
+                    split_at += 1 + rand32(l_diff - f_diff - 1);
+                elem.data.resize(split_at);
+                elem.data.insert(elem.data.end(), b.begin() + split_at,
+                                 b.end());
+                changed = changed || elem.data != a;
+                break;
+            }
         }
     }
 
-    return is_interesting;
+    if (!changed && last_diff >= 0) {
+        const auto& b = other.inputs[last_diff].data;
+        spliced.inputs[last_diff].data.assign(b.begin(), b.end());
+        changed = true;
+    }
+    return changed;
 }
 
-void assignEnergy(InputSeed& input, int seed_count) {
-    // Metadata about number of times we chose a seed
-    static int chosen_count_total = 0;
-    const int BASE_ENERGY = 1;
+/* Whether a change of a value is a walking bit or byte flip, which the
+   bit flip stages have tried already (AFL's could_be_bitflip()). */
 
-    // If it's above average, don't fuzz it again
-    if (input.chosen_count > chosen_count_total / seed_count) {
-        input.energy = 0;
-        return;
+static bool could_be_bitflip(uint32_t xor_val) {
+    if (!xor_val)
+        return true;
+
+    uint32_t sh = 0;
+    while (!(xor_val & 1)) {
+        sh++;
+        xor_val >>= 1;
     }
 
-    // If it's below, fuzz it with exponential growth
-    input.chosen_count++;
-    chosen_count_total++;
-    input.energy = BASE_ENERGY * static_cast<int>(pow(2, input.chosen_count));
-    return;
+    if (xor_val == 1 || xor_val == 3 || xor_val == 15)
+        return true;
+
+    if (sh & 7)
+        return false;
+
+    return xor_val == 0xff || xor_val == 0xffff || xor_val == 0xffffffff;
 }
 
-InputSeed mutateSeed(InputSeed seed) {
-    seed.chosen_count = 0;
-    seed.energy = 0;
-    // Copies the input seed to avoid mangling it
-    for (auto& elem : seed.inputs) {
-        if (!elem.format.validChoices.empty()) {
+template <typename T>
+static T load_le(const std::byte* p) {
+    T value;
+    memcpy(&value, p, sizeof(T));
+    return value;
+}
 
-            // if there are a set of valid choices, pick a random one to be the next input
-            elem.data =
-                elem.format
-                    .validChoices[rand32(elem.format.validChoices.size())];
+template <typename T>
+static void store_le(std::byte* p, T value) {
+    memcpy(p, &value, sizeof(T));
+}
 
-        } else if (elem.format.validSet.size() > 0) {
-            // If there is a valid set, use it to mutate the input
-            fuzz_set(elem.data, elem.format.validSet, elem.format.minLen,
-                     elem.format.maxLen);
-        } else {
+static uint32_t next_p2(uint32_t val) {
+    uint32_t ret = 1;
+    while (val > ret)
+        ret <<= 1;
+    return ret;
+}
 
-            // Otherwise, put it through the mutation process.
-            fuzz(elem.data, elem.format.minLen, elem.format.maxLen);
+/**
+ * @brief AFL's trim stage for a seed on its first pass. Chunks of a power of
+ * two size are cut from each field in turn, from 1/16 of its length down to
+ * 1/1024, and a cut is kept if the coverage checksum stays that of the
+ * seed. The fix-ups of the config are applied to every attempt, so a cut
+ * token keeps its length field right. Fields with valid choices or computed
+ * values are left alone, and none is cut below its minimum length.
+ *
+ * @param seed Seed to trim, it is trimmed in place.
+ * @param trial Holds each attempt.
+ * @param run Runs an input and returns the checksum of its coverage.
+ * @return Number of runs.
+*/
+size_t trim_seed(InputSeed& seed, InputSeed& trial, const seed_runner& run) {
+    const uint32_t base_cksum = run(seed, true);
+    size_t runs = 1;
+
+    // Brings the attempt back to the seed, fix-ups may have changed any field
+    auto reset_trial = [&]() {
+        trial.inputs.resize(seed.inputs.size());
+        for (size_t f = 0; f < seed.inputs.size(); f++) {
+            trial.inputs[f].format = seed.inputs[f].format;
+            trial.inputs[f].data.assign(seed.inputs[f].data.begin(),
+                                        seed.inputs[f].data.end());
+        }
+    };
+    reset_trial();
+
+    for (size_t f = 0; f < seed.inputs.size(); f++) {
+        const Field& format = *seed.inputs[f].format;
+        const auto& data = seed.inputs[f].data;
+        if (!format.validChoices.empty() || format.fixup != FieldFixup::NONE ||
+            data.size() <= TRIM_MIN_BYTES)
+            continue;
+
+        const uint32_t len_p2 = next_p2(data.size());
+        uint32_t remove_len =
+            std::max<uint32_t>(len_p2 / TRIM_START_STEPS, TRIM_MIN_BYTES);
+        while (remove_len >=
+               std::max<uint32_t>(len_p2 / TRIM_END_STEPS, TRIM_MIN_BYTES)) {
+            uint32_t remove_pos = 0;
+            while (remove_pos < data.size() && data.size() > format.minLen) {
+                uint32_t trim_avail = std::min<uint32_t>(
+                    remove_len, data.size() - remove_pos);
+                trim_avail =
+                    std::min<uint32_t>(trim_avail, data.size() - format.minLen);
+
+                auto& cut = trial.inputs[f].data;
+                cut.assign(data.begin(), data.begin() + remove_pos);
+                cut.insert(cut.end(), data.begin() + remove_pos + trim_avail,
+                           data.end());
+                fixup_seed(trial);
+                runs++;
+
+                if (run(trial, false) == base_cksum) {
+                    /* The chunk does not matter, keep the seed without it
+                       and try the same position again. */
+                    for (size_t i = 0; i < seed.inputs.size(); i++)
+                        seed.inputs[i].data.assign(trial.inputs[i].data.begin(),
+                                                   trial.inputs[i].data.end());
+                } else {
+                    remove_pos += remove_len;
+                    reset_trial();
+                }
+            }
+            remove_len >>= 1;
         }
     }
-    return seed;
+    return runs;
 }
 
-void fuzz_set(std::vector<std::byte>& fuzz_data,
-              const std::vector<std::byte>& valid_set, int minLen, int maxLen) {
+/**
+ * @brief AFL's deterministic stages for a seed on its first pass: walking bit
+ * flips of 1, 2 and 4 bits, byte flips of 1, 2 and 4 bytes, adding and
+ * subtracting up to ARITH_MAX, and overwriting with the interesting values,
+ * in both endians. Fields with valid choices, a valid set or a mutator of
+ * the driver are left to the random stages, and no stage changes the length
+ * of a field.
+ *
+ * Byte flips that leave the coverage checksum unchanged mark the byte as
+ * ineffective in the effector map, and the later stages skip such bytes.
+ * Runs of byte flips with the same checksum are added to the auto-detected
+ * tokens of the field.
+ *
+ * @param seed Seed to walk, mutated holds each step.
+ * @param run Runs an input and returns the checksum of its coverage.
+ * @return Number of runs.
+*/
+size_t deterministic_stages(const InputSeed& seed, InputSeed& mutated,
+                            const seed_runner& run) {
+    // Bytes whose flip changed the coverage, reused between fields
+    static std::vector<uint8_t> eff_map;
+
+    mutated.inputs.resize(seed.inputs.size());
+    for (size_t f = 0; f < seed.inputs.size(); f++) {
+        mutated.inputs[f].format = seed.inputs[f].format;
+        mutated.inputs[f].data.assign(seed.inputs[f].data.begin(),
+                                      seed.inputs[f].data.end());
+    }
+    const uint32_t base_cksum = run(mutated, true);
+    size_t runs = 1;
+
+    for (auto& elem : mutated.inputs) {
+        if (!elem.format->validChoices.empty() ||
+            !elem.format->validSet.empty() ||
+            !elem.format->mutator.empty() || elem.data.empty())
+            continue;
+
+        std::byte* out_buf = elem.data.data();
+        const uint32_t len = elem.data.size();
+
+        /* Walking bit flips: 1, 2 and 4 bits at a time. */
+
+        for (uint32_t flip_bits : {1, 2, 4}) {
+            for (uint32_t bit = 0; bit + flip_bits <= len << 3; bit++) {
+                for (uint32_t k = 0; k < flip_bits; k++)
+                    FLIP_BIT(out_buf, bit + k);
+                run(mutated, false);
+                runs++;
+                for (uint32_t k = 0; k < flip_bits; k++)
+                    FLIP_BIT(out_buf, bit + k);
+            }
+        }
+
+        /* Walking byte flips, which also fill in the effector map. Short
+           fields count as effective throughout.
+
+           A run of bytes whose flips all give the same coverage, other than
+           the seed's, is likely a token the target compares against as a
+           whole, like a keyword or a magic value. Runs of a fitting length
+           are kept for the dictionary mutations. */
+
+        TokenTable& found = auto_tokens[elem.format->index];
+        uint32_t token_start = 0;
+        uint32_t token_cksum = base_cksum;
+        auto collect_token = [&](uint32_t end) {
+            uint32_t token_len = end - token_start;
+            if (token_cksum != base_cksum && token_len >= MIN_AUTO_EXTRA &&
+                token_len <= MAX_AUTO_EXTRA && found.size() < MAX_AUTO_EXTRAS)
+                found.add(out_buf + token_start, token_len);
+        };
+
+        eff_map.assign(len, len < EFF_MIN_LEN);
+        uint32_t eff_count = 0;
+        for (uint32_t i = 0; i < len; i++) {
+            out_buf[i] ^= std::byte{0xFF};
+            uint32_t cksum = run(mutated, false);
+            if (cksum != base_cksum)
+                eff_map[i] = 1;
+            runs++;
+            out_buf[i] ^= std::byte{0xFF};
+            eff_count += eff_map[i];
+
+            if (cksum != token_cksum) {
+                collect_token(i);
+                token_start = i;
+                token_cksum = cksum;
+            }
+        }
+        collect_token(len);
+        if (eff_count * 100 > len * EFF_MAX_PERC)
+            eff_map.assign(len, 1);
+
+        auto effective = [](uint32_t pos, uint32_t n) {
+            for (uint32_t k = 0; k < n; k++) {
+                if (eff_map[pos + k])
+                    return true;
+            }
+            return false;
+        };
+
+        for (uint32_t i = 0; i + 2 <= len; i++) {
+            if (!effective(i, 2))
+                continue;
+            store_le<uint16_t>(out_buf + i,
+                               load_le<uint16_t>(out_buf + i) ^ 0xFFFF);
+            run(mutated, false);
+            runs++;
+            store_le<uint16_t>(out_buf + i,
+                               load_le<uint16_t>(out_buf + i) ^ 0xFFFF);
+        }
+
+        for (uint32_t i = 0; i + 4 <= len; i++) {
+            if (!effective(i, 4))
+                continue;
+            store_le<uint32_t>(out_buf + i,
+                               load_le<uint32_t>(out_buf + i) ^ 0xFFFFFFFF);
+            run(mutated, false);
+            runs++;
+            store_le<uint32_t>(out_buf + i,
+                               load_le<uint32_t>(out_buf + i) ^ 0xFFFFFFFF);
+        }
+
+        /* Arithmetic on bytes, words and dwords. Results a bit flip could
+           give are skipped, and so are word and dword changes that don't
+           carry over into the next byte, which the narrower stage covers. */
+
+        auto try_value = [&](uint32_t pos, auto orig, auto value) {
+            if (value == orig || could_be_bitflip(orig ^ value))
+                return;
+            store_le(out_buf + pos, value);
+            run(mutated, false);
+            runs++;
+            store_le(out_buf + pos, orig);
+        };
+
+        for (uint32_t i = 0; i < len; i++) {
+            if (!eff_map[i])
+                continue;
+            uint8_t orig = load_le<uint8_t>(out_buf + i);
+            for (uint32_t j = 1; j <= ARITH_MAX; j++) {
+                try_value(i, orig, static_cast<uint8_t>(orig + j));
+                try_value(i, orig, static_cast<uint8_t>(orig - j));
+            }
+        }
+
+        for (uint32_t i = 0; i + 2 <= len; i++) {
+            if (!effective(i, 2))
+                continue;
+            uint16_t orig = load_le<uint16_t>(out_buf + i);
+            uint16_t r_orig = SWAP16(orig);
+            for (uint32_t j = 1; j <= ARITH_MAX; j++) {
+                if ((orig & 0xff) + j > 0xff)
+                    try_value(i, orig, static_cast<uint16_t>(orig + j));
+                if ((orig & 0xff) < j)
+                    try_value(i, orig, static_cast<uint16_t>(orig - j));
+                if ((r_orig & 0xff) + j > 0xff)
+                    try_value(i, orig, SWAP16(r_orig + j));
+                if ((r_orig & 0xff) < j)
+                    try_value(i, orig, SWAP16(r_orig - j));
+            }
+        }
+
+        for (uint32_t i = 0; i + 4 <= len; i++) {
+            if (!effective(i, 4))
+                continue;
+            uint32_t orig = load_le<uint32_t>(out_buf + i);
+            uint32_t r_orig = SWAP32(orig);
+            for (uint32_t j = 1; j <= ARITH_MAX; j++) {
+                if ((orig & 0xffff) + j > 0xffff)
+                    try_value(i, orig, orig + j);
+                if ((orig & 0xffff) < j)
+                    try_value(i, orig, orig - j);
+                if ((r_orig & 0xffff) + j > 0xffff)
+                    try_value(i, orig, SWAP32(r_orig + j));
+                if ((r_orig & 0xffff) < j)
+                    try_value(i, orig, SWAP32(r_orig - j));
+            }
+        }
+
+        /* Interesting values, in both endians for words and dwords. */
+
+        for (uint32_t i = 0; i < len; i++) {
+            if (!eff_map[i])
+                continue;
+            uint8_t orig = load_le<uint8_t>(out_buf + i);
+            for (int8_t value : interesting_8)
+                try_value(i, orig, static_cast<uint8_t>(value));
+        }
+
+        for (uint32_t i = 0; i + 2 <= len; i++) {
+            if (!effective(i, 2))
+                continue;
+            uint16_t orig = load_le<uint16_t>(out_buf + i);
+            for (int16_t value : interesting_16) {
+                try_value(i, orig, static_cast<uint16_t>(value));
+                if (SWAP16(value) != static_cast<uint16_t>(value))
+                    try_value(i, orig, SWAP16(value));
+            }
+        }
+
+        for (uint32_t i = 0; i + 4 <= len; i++) {
+            if (!effective(i, 4))
+                continue;
+            uint32_t orig = load_le<uint32_t>(out_buf + i);
+            for (int32_t value : interesting_32) {
+                try_value(i, orig, static_cast<uint32_t>(value));
+                if (SWAP32(value) != static_cast<uint32_t>(value))
+                    try_value(i, orig, SWAP32(value));
+            }
+        }
+    }
+    return runs;
+}
+
+/* Picks the token table for a dictionary mutation, the user's dictionary or
+   the auto-detected tokens with even odds. One of them must not be empty. */
+
+static const TokenTable& pick_tokens(const TokenTable& dict,
+                                     const TokenTable& found) {
+    if (dict.empty() || (!found.empty() && rand32(2)))
+        return found;
+    return dict;
+}
+
+/* Overwrites bytes with a token, if the data is long enough. */
+
+static void overwrite_token(std::vector<std::byte>& fuzz_data,
+                            const TokenTable& tokens) {
+    uint32_t use_token = rand32(tokens.size());
+    uint32_t token_len = tokens.length(use_token);
+
+    if (token_len > fuzz_data.size())
+        return;
+
+    uint32_t insert_at = rand32(fuzz_data.size() - token_len + 1);
+    memcpy(fuzz_data.data() + insert_at, tokens.token(use_token), token_len);
+}
+
+/* Inserts a token, if the data stays within maxLen. */
+
+static void insert_token(std::vector<std::byte>& fuzz_data, uint32_t maxLen,
+                         const TokenTable& tokens) {
+    uint32_t use_token = rand32(tokens.size());
+    uint32_t token_len = tokens.length(use_token);
+
+    if (fuzz_data.size() + token_len > maxLen ||
+        fuzz_data.size() + token_len >= MAX_FILE)
+        return;
+
+    uint32_t insert_at = rand32(fuzz_data.size() + 1);
+    const std::byte* token = tokens.token(use_token);
+    fuzz_data.insert(fuzz_data.begin() + insert_at, token, token + token_len);
+}
+
+void fuzz_set(std::vector<std::byte>& fuzz_data, const Field& format) {
+    const std::vector<std::byte>& valid_set = format.validSet;
+    const int minLen = format.minLen;
+    const int maxLen = format.maxLen;
+    const TokenTable& dict = format.tokens;
+    const TokenTable& found = auto_tokens[format.index];
+    // The token operators can only be picked if there are any tokens
+    const bool have_tokens = !dict.empty() || !found.empty();
     int32_t stage_max = 1;  // arbitrary for now
 
     for (int32_t stage_cur = 0; stage_cur < stage_max; stage_cur++) {
@@ -385,7 +1181,9 @@ void fuzz_set(std::vector<std::byte>& fuzz_data,
         // stage_cur_val = use_stacking;
 
         for (uint32_t i = 0; i < use_stacking; i++) {
-            uint32_t c = rand32(5);
+            uint32_t c = schedule.pick(
+                format.index,
+                have_tokens ? SET_OPERATORS : SET_OPERATORS - TOKEN_OPERATORS);
             switch (c) {
                 case 0: {
 
@@ -397,7 +1195,7 @@ void fuzz_set(std::vector<std::byte>& fuzz_data,
                     fuzz_data[pos] = valid_set[rand32(valid_set.size())];
                     break;
                 }
-                case 1 ... 2: {
+                case 1: {
 
                     /* Delete bytes. We're making this a bit more likely
                     than insertion (the next option) in hopes of keeping
@@ -420,7 +1218,7 @@ void fuzz_set(std::vector<std::byte>& fuzz_data,
 
                     break;
                 }
-                case 3: {
+                case 2: {
 
                     if (fuzz_data.size() + HAVOC_BLK_XL < MAX_FILE) {
 
@@ -428,7 +1226,9 @@ void fuzz_set(std::vector<std::byte>& fuzz_data,
 
                         uint8_t actually_clone = rand32(4);
                         uint32_t clone_from, clone_to, clone_len;
-                        std::vector<std::byte> new_buf = fuzz_data;
+                        // Written over the data in place, which only grows
+                        // when the block goes past its end
+                        const size_t old_size = fuzz_data.size();
                         uint32_t max_blk_len = fuzz_data.size() < maxLen
                                                    ? fuzz_data.size()
                                                    : maxLen;
@@ -450,34 +1250,29 @@ void fuzz_set(std::vector<std::byte>& fuzz_data,
                                 : maxLen - clone_len;
                         clone_to = rand32(clone_to_lim);
 
-                        if (clone_to + clone_len > new_buf.size()) {
-                            new_buf.resize(clone_to + clone_len);
+                        if (clone_to + clone_len > fuzz_data.size()) {
+                            fuzz_data.resize(clone_to + clone_len);
                         }
 
                         /* Inserted part */
                         if (actually_clone)
-                            memcpy(new_buf.data() + clone_to,
-                                   fuzz_data.data() + clone_from, clone_len);
+                            memmove(fuzz_data.data() + clone_to,
+                                    fuzz_data.data() + clone_from, clone_len);
                         else
                             memset(
-                                new_buf.data() + clone_to,
+                                fuzz_data.data() + clone_to,
                                 rand32(2)
                                     ? static_cast<char>(
                                           valid_set[rand32(valid_set.size())])
                                     : static_cast<char>(
-                                          fuzz_data[rand32(fuzz_data.size())]),
+                                          fuzz_data[rand32(old_size)]),
                                 clone_len);
-
-                        if (new_buf.size() > maxLen) {
-                            int a = 1;
-                        }
-                        fuzz_data = std::move(new_buf);
                     }
 
                     break;
                 }
 
-                case 4: {
+                case 3: {
 
                     /* Overwrite bytes with a randomly selected chunk (75%) or fixed
                       bytes (25%). */
@@ -509,12 +1304,30 @@ void fuzz_set(std::vector<std::byte>& fuzz_data,
 
                     break;
                 }
+
+                /* Values 4 and 5 can be selected only if there are tokens. */
+
+                case 4: {
+                    overwrite_token(fuzz_data, pick_tokens(dict, found));
+                    break;
+                }
+
+                case 5: {
+                    insert_token(fuzz_data, maxLen, pick_tokens(dict, found));
+                    break;
+                }
             }
         }
     }
 }
 
-void fuzz(std::vector<std::byte>& fuzz_data, int minLen, int maxLen) {
+void fuzz(std::vector<std::byte>& fuzz_data, const Field& format) {
+    const int minLen = format.minLen;
+    const int maxLen = format.maxLen;
+    const TokenTable& dict = format.tokens;
+    const TokenTable& found = auto_tokens[format.index];
+    // The token operators can only be picked if there are any tokens
+    const bool have_tokens = !dict.empty() || !found.empty();
 
     int32_t stage_max = 1;  // arbitrary for now
 
@@ -525,7 +1338,9 @@ void fuzz(std::vector<std::byte>& fuzz_data, int minLen, int maxLen) {
         // stage_cur_val = use_stacking;
 
         for (uint32_t i = 0; i < use_stacking; i++) {
-            uint32_t c = rand32(15);
+            uint32_t c = schedule.pick(
+                format.index, have_tokens ? BYTE_OPERATORS
+                                          : BYTE_OPERATORS - TOKEN_OPERATORS);
             switch (c) {
 
                 case 0:
@@ -728,7 +1543,7 @@ void fuzz(std::vector<std::byte>& fuzz_data, int minLen, int maxLen) {
                     break;
                 }
 
-                case 11 ... 12: {
+                case 11: {
 
                     /* Delete bytes. We're making this a bit more likely
                         than insertion (the next option) in hopes of keeping
@@ -752,7 +1567,7 @@ void fuzz(std::vector<std::byte>& fuzz_data, int minLen, int maxLen) {
                     break;
                 }
 
-                case 13: {
+                case 12: {
 
                     if (fuzz_data.size() + HAVOC_BLK_XL < MAX_FILE) {
 
@@ -760,7 +1575,9 @@ void fuzz(std::vector<std::byte>& fuzz_data, int minLen, int maxLen) {
 
                         uint8_t actually_clone = rand32(4);
                         uint32_t clone_from, clone_to, clone_len;
-                        std::vector<std::byte> new_buf = fuzz_data;
+                        // Written over the data in place, which only grows
+                        // when the block goes past its end
+                        const size_t old_size = fuzz_data.size();
                         uint32_t max_blk_len = fuzz_data.size() < maxLen
                                                    ? fuzz_data.size()
                                                    : maxLen;
@@ -782,33 +1599,28 @@ void fuzz(std::vector<std::byte>& fuzz_data, int minLen, int maxLen) {
                                 : maxLen - clone_len;
                         clone_to = rand32(clone_to_lim);
 
-                        if (clone_to + clone_len > new_buf.size()) {
-                            new_buf.resize(clone_to + clone_len);
+                        if (clone_to + clone_len > fuzz_data.size()) {
+                            fuzz_data.resize(clone_to + clone_len);
                         }
 
                         /* Inserted part */
                         if (actually_clone)
-                            memcpy(new_buf.data() + clone_to,
-                                   fuzz_data.data() + clone_from, clone_len);
+                            memmove(fuzz_data.data() + clone_to,
+                                    fuzz_data.data() + clone_from, clone_len);
                         else
                             memset(
-                                new_buf.data() + clone_to,
+                                fuzz_data.data() + clone_to,
                                 rand32(2)
                                     ? rand32(256)
                                     : static_cast<char>(
-                                          fuzz_data[rand32(fuzz_data.size())]),
+                                          fuzz_data[rand32(old_size)]),
                                 clone_len);
-
-                        if (new_buf.size() > maxLen) {
-                            int a = 1;
-                        }
-                        fuzz_data = std::move(new_buf);
                     }
 
                     break;
                 }
 
-                case 14: {
+                case 13: {
 
                     /* Overwrite bytes with a randomly selected chunk (75%) or fixed
                       bytes (25%). */
@@ -839,11 +1651,23 @@ void fuzz(std::vector<std::byte>& fuzz_data, int minLen, int maxLen) {
 
                     break;
                 }
+                /* Values 14 and 15 can be selected only if there are tokens. */
+
+                case 14: {
+                    overwrite_token(fuzz_data, pick_tokens(dict, found));
+                    break;
+                }
+
                 case 15: {
-                    // Like case 13, but instead of copying only once, it copies a random amount of times to the end.
+                    insert_token(fuzz_data, maxLen, pick_tokens(dict, found));
+                    break;
+                }
+
+                case 16: {
+                    // Like case 12, but instead of copying only once, it copies a random amount of times to the end.
                     uint8_t actually_clone = rand32(4);
                     uint32_t clone_from, clone_to, clone_len;
-                    std::vector<std::byte> new_buf = fuzz_data;
+                    const size_t old_size = fuzz_data.size();
                     uint32_t max_blk_len =
                         std::min(static_cast<int>(fuzz_data.size()), maxLen);
 
@@ -863,129 +1687,44 @@ void fuzz(std::vector<std::byte>& fuzz_data, int minLen, int maxLen) {
                     uint32_t clone_count =
                         rand32(((maxLen - clone_to) / clone_len) + 1);
 
-                    if (clone_to + clone_len > new_buf.size()) {
-                        new_buf.resize(clone_to + clone_len * clone_count);
+                    // The clones overwrite the data in place, so they are
+                    // taken from a copy of the block
+                    if (actually_clone) {
+                        if (clone_block.capacity() < HAVOC_BLK_XL)
+                            clone_block.reserve(HAVOC_BLK_XL);
+                        clone_block.assign(
+                            fuzz_data.begin() + clone_from,
+                            fuzz_data.begin() + clone_from + clone_len);
+                    }
+                    if (clone_to + clone_len > fuzz_data.size()) {
+                        fuzz_data.resize(clone_to + clone_len * clone_count);
                     }
 
                     /* Inserted part */
                     if (actually_clone) {
                         for (int i = 0; i < clone_count; i++) {
-                            memcpy(new_buf.data() + clone_to * i,
-                                   fuzz_data.data() + clone_from, clone_len);
+                            memcpy(fuzz_data.data() + clone_to * i,
+                                   clone_block.data(), clone_len);
                         }
                     } else {
                         for (int i = 0; i < clone_count; i++) {
                             memset(
-                                new_buf.data() + clone_to * i,
+                                fuzz_data.data() + clone_to * i,
                                 rand32(2)
                                     ? rand32(256)
                                     : static_cast<char>(
-                                          fuzz_data[rand32(fuzz_data.size())]),
+                                          fuzz_data[rand32(old_size)]),
                                 clone_len);
                         }
                     }
 
-                    if (new_buf.size() > maxLen) {
+                    if (fuzz_data.size() > maxLen) {
                         std::cout << "Error with new buffer size" << std::endl;
                         assert(false);
-                        int a = 1;
                     }
-                    fuzz_data = std::move(new_buf);
 
                     break;
                 }
-
-                    // /* Values 15 and 16 can be selected only if there are any extras
-                    //    present in the dictionaries. */
-
-                    // case 15: {
-
-                    //     /* Overwrite bytes with an extra. */
-
-                    //     if (!extras_cnt || (a_extras_cnt && rand32(2))) {
-
-                    //       /* No user-specified extras or odds in our favor. Let's use an
-                    //          auto-detected one. */
-
-                    //       uint32_t use_extra = rand32(a_extras_cnt);
-                    //       uint32_t extra_len = a_extras[use_extra].len;
-                    //       uint32_t insert_at;
-
-                    //       if (extra_len > size) break;
-
-                    //       insert_at = rand32(size - extra_len + 1);
-                    //       memcpy(output.data() + insert_at, a_extras[use_extra].data, extra_len);
-
-                    //     } else {
-
-                    //       /* No auto extras or odds in our favor. Use the dictionary. */
-
-                    //       uint32_t use_extra = rand32(extras_cnt);
-                    //       uint32_t extra_len = extras[use_extra].len;
-                    //       uint32_t insert_at;
-
-                    //       if (extra_len > size) break;
-
-                    //       insert_at = rand32(size - extra_len + 1);
-                    //       memcpy(output.data() + insert_at, extras[use_extra].data, extra_len);
-
-                    //     }
-
-                    //     break;
-
-                    //   }
-
-                    // case 16: {
-
-                    //     uint32_t use_extra, extra_len, insert_at = rand32(size + 1);
-                    //     uint8_t* new_buf;
-
-                    //     /* Insert an extra. Do the same dice-rolling stuff as for the
-                    //        previous case. */
-
-                    //     if (!extras_cnt || (a_extras_cnt && rand32(2))) {
-
-                    //       use_extra = rand32(a_extras_cnt);
-                    //       extra_len = a_extras[use_extra].len;
-
-                    //       if (size + extra_len >= MAX_FILE) break;
-
-                    //       new_buf = ck_alloc_nozero(size + extra_len);
-
-                    //       /* Head */
-                    //       memcpy(new_buf, output.data(), insert_at);
-
-                    //       /* Inserted part */
-                    //       memcpy(new_buf + insert_at, a_extras[use_extra].data, extra_len);
-
-                    //     } else {
-
-                    //       use_extra = rand32(extras_cnt);
-                    //       extra_len = extras[use_extra].len;
-
-                    //       if (size + extra_len >= MAX_FILE) break;
-
-                    //       new_buf = ck_alloc_nozero(size + extra_len);
-
-                    //       /* Head */
-                    //       memcpy(new_buf, output.data(), insert_at);
-
-                    //       /* Inserted part */
-                    //       memcpy(new_buf + insert_at, extras[use_extra].data, extra_len);
-
-                    //     }
-
-                    //     /* Tail */
-                    //     memcpy(new_buf + insert_at + extra_len, output.data() + insert_at,
-                    //            size - insert_at);
-
-                    //     ck_free(output);
-                    //     output   = new_buf;
-                    //     size += extra_len;
-
-                    //     break;
-
-                    // }
             }
 
             if (fuzz_data.size() > maxLen) {
@@ -10,9 +10,9 @@
 */
 json InputSeed::to_json() const {
     json out;
-    for (InputField input : inputs) {
-        std::string name = input.format.name;
-        switch (input.format.type)
+    for (const InputField& input : inputs) {
+        const std::string& name = input.format->name;
+        switch (input.format->type)
         {
         case FieldTypes::INTEGER: {
             int val = static_cast<int>((input.data[3] << 24) | (input.data[2] << 16) | (input.data[1] << 8) | input.data[0]);
@@ -1,12 +1,16 @@
 #pragma once
 #include <cstddef>
 #include <vector>
+#include "dictionary.h"
 #include "json.hpp"
 
 using json = nlohmann::json;
 
 enum class FieldTypes { STRING, INTEGER, BINARY };
 
+// Values computed from other fields after mutation, see fixup.h
+enum class FieldFixup { NONE, LENGTH_OF, CRC_OF };
+
 typedef struct {
     unsigned int minLen;
     unsigned int maxLen;
@@ -14,18 +18,26 @@ typedef struct {
     std::string name;
     std::vector<std::vector<std::byte>> validChoices;
     std::vector<std::byte> validSet;
+    TokenTable tokens;   // From the "dictionary" file and "tokens" list
+    unsigned int index;  // Position in the config
+    std::string mutator;  // Structure-aware mutator of the driver, if any
+    FieldFixup fixup;
+    std::vector<unsigned int> fixupSources;  // Indices of the fields it is computed from
+    bool littleEndian;      // Byte order of a computed value
+    unsigned int clampTo;   // Length the data is cut to after mutation
 } Field;
 
+// Fields are read once from the config and never change afterwards, so inputs
+// only point to theirs instead of carrying a copy
 typedef struct {
-    Field format;
+    const Field* format;
     std::vector<std::byte> data;
 } InputField;
 
+// Scheduling data of queued seeds is kept in the SeedStore, see corpus.h
 typedef struct {
     std::vector<InputField> inputs;
-    unsigned int energy;
     json to_json() const;
-    int chosen_count = 0;
 } InputSeed;
 
 typedef struct {
@@ -34,4 +46,4 @@ typedef struct {
 } Input;
 
 json inputVectorToJSON(const std::vector<Input>& input);
-std::vector<Input> makeInputsFromSeed(const InputSeed& seed);
\ No newline at end of file
+void makeInputsFromSeed(const InputSeed& seed, std::vector<Input>& inputs);
\ No newline at end of file
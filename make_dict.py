@@ -0,0 +1,88 @@
+"""Collects the string literals of Python sources into an AFL dictionary.
+
+Usage: python3 make_dict.py <output.dict> <file or folder>...
+
+Folders are searched for .py files. Works on Python 2 sources too, as only
+the tokens are read. Docstrings and literals longer than MAX_DICT_FILE in
+config.h are left out.
+"""
+import ast
+import os
+import sys
+import tokenize
+import warnings
+
+MAX_DICT_FILE = 128
+
+
+def literals(path):
+    with open(path, "rb") as f:
+        try:
+            tokens = list(tokenize.tokenize(f.readline))
+        except (tokenize.TokenError, SyntaxError):
+            return
+    for tok in tokens:
+        if tok.type != tokenize.STRING:
+            continue
+        text = tok.string
+        # Triple quoted strings are docstrings, or text no parser matches on
+        if text.lstrip("rRbBuUfF")[:3] in ('"""', "'''"):
+            continue
+        if text[:1] in "fF" or text[1:2] in "fF":
+            continue
+        try:
+            with warnings.catch_warnings():
+                # Python 2 sources have escapes Python 3 warns about
+                warnings.simplefilter("ignore")
+                value = ast.literal_eval(text)
+        except (ValueError, SyntaxError):
+            continue
+        if isinstance(value, str):
+            value = value.encode("utf-8")
+        if value.strip() and len(value) <= MAX_DICT_FILE:
+            yield value
+
+
+def sources(paths):
+    for path in paths:
+        if os.path.isdir(path):
+            for root, dirs, files in os.walk(path):
+                dirs.sort()
+                for name in sorted(files):
+                    if name.endswith(".py"):
+                        yield os.path.join(root, name)
+        else:
+            yield path
+
+
+def escape(value):
+    out = ""
+    for b in value:
+        if b == ord("\\") or b == ord('"'):
+            out += "\\" + chr(b)
+        elif 32 <= b < 127:
+            out += chr(b)
+        else:
+            out += "\\x%02x" % b
+    return '"' + out + '"'
+
+
+def main():
+    if len(sys.argv) < 3:
+        print(__doc__.strip().splitlines()[2], file=sys.stderr)
+        sys.exit(1)
+
+    seen = set()
+    with open(sys.argv[1], "w") as out:
+        out.write("# Generated by make_dict.py from " +
+                  " ".join(sys.argv[2:]) + "\n")
+        for path in sources(sys.argv[2:]):
+            for value in literals(path):
+                if value not in seen:
+                    seen.add(value)
+                    out.write(escape(value) + "\n")
+    print("%d tokens written to %s" % (len(seen), sys.argv[1]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,139 @@
+#include "operators.h"
+#include <fstream>
+#include "config.h"
+#include "rng.h"
+
+OperatorSchedule schedule;
+
+static const char* const byte_operator_names[BYTE_OPERATORS] = {
+    "flip_bit",    "interesting8", "interesting16",   "interesting32",
+    "sub8",        "add8",         "sub16",           "add16",
+    "sub32",       "add32",        "random_byte",     "delete",
+    "clone",       "overwrite",    "token_overwrite", "token_insert"};
+
+static const char* const set_operator_names[SET_OPERATORS] = {
+    "set_byte", "delete", "clone", "overwrite", "token_overwrite",
+    "token_insert"};
+
+// Deletion starts out twice as likely as the other operators, like it was
+// with the uniform draw, to keep inputs reasonably small
+static const uint32_t BYTE_DELETE = 11;
+static const uint32_t SET_DELETE = 1;
+
+void OperatorSchedule::init(const std::vector<Field>& fields,
+                            const std::string& dump_path) {
+    this->dump_path = dump_path;
+    stats.assign(fields.size(), {});
+    field_names.assign(fields.size(), "");
+    operator_names.assign(fields.size(), nullptr);
+
+    for (const auto& field : fields) {
+        // Fields with valid choices are never mutated by havoc
+        if (!field.validChoices.empty())
+            continue;
+        const bool set = !field.validSet.empty();
+        const uint32_t count = set ? SET_OPERATORS : BYTE_OPERATORS;
+        const uint32_t delete_op = set ? SET_DELETE : BYTE_DELETE;
+
+        auto& table = stats[field.index];
+        table.assign(count, OperatorStats{});
+        for (uint32_t op = 0; op < count; op++)
+            table[op].probability =
+                (op == delete_op ? 2.0 : 1.0) / (count + 1);
+        field_names[field.index] = field.name;
+        operator_names[field.index] =
+            set ? set_operator_names : byte_operator_names;
+    }
+}
+
+uint32_t OperatorSchedule::pick(unsigned int field, uint32_t available) {
+    auto& table = stats[field];
+    double total = 0;
+    for (uint32_t op = 0; op < available; op++)
+        total += table[op].probability;
+
+    // Uniform double in [0, total)
+    double x = (rng.next64() >> 11) * 0x1.0p-53 * total;
+    uint32_t op = 0;
+    while (op + 1 < available && x >= table[op].probability) {
+        x -= table[op].probability;
+        op++;
+    }
+
+    table[op].uses++;
+    table[op].total_uses++;
+    table[op].pending++;
+    return op;
+}
+
+void OperatorSchedule::reward(bool found) {
+    for (auto& table : stats) {
+        for (auto& op : table) {
+            if (found) {
+                op.finds += op.pending;
+                op.total_finds += op.pending;
+            }
+            op.pending = 0;
+        }
+    }
+
+    if (++execs % OPERATOR_UPDATE_EXECS == 0) {
+        update();
+        dump();
+    }
+}
+
+void OperatorSchedule::update() {
+    for (auto& table : stats) {
+        // Operators that never ran, like the token ones of a field without
+        // tokens, keep their share, the others split the rest
+        double field_uses = 0, field_finds = 0, share = 0;
+        uint32_t used = 0;
+        for (const auto& op : table) {
+            if (op.total_uses == 0)
+                continue;
+            field_uses += op.uses;
+            field_finds += op.finds;
+            share += op.probability;
+            used++;
+        }
+        if (used == 0)
+            continue;
+
+        // The yield of an operator is shrunk towards the yield of the
+        // field, so one that was hardly used lately counts as average
+        // rather than as a sure thing or a dud
+        const double mean = (field_finds + 1) / (field_uses + 1);
+        double total = 0;
+        for (auto& op : table) {
+            if (op.total_uses == 0)
+                continue;
+            op.probability = (op.finds + OPERATOR_PRIOR_USES * mean) /
+                             (op.uses + OPERATOR_PRIOR_USES);
+            total += op.probability;
+        }
+
+        for (auto& op : table) {
+            if (op.total_uses == 0)
+                continue;
+            op.probability = share * ((1 - OPERATOR_EXPLORE) *
+                                          op.probability / total +
+                                      OPERATOR_EXPLORE / used);
+            op.uses *= OPERATOR_DECAY;
+            op.finds *= OPERATOR_DECAY;
+        }
+    }
+}
+
+void OperatorSchedule::dump() const {
+    std::ofstream file{dump_path, std::ios::trunc};
+    file << "field,operator,uses,finds,probability" << std::endl;
+    for (size_t field = 0; field < stats.size(); field++) {
+        for (size_t op = 0; op < stats[field].size(); op++) {
+            const auto& s = stats[field][op];
+            file << field_names[field] << "," << operator_names[field][op]
+                 << "," << s.total_uses << "," << s.total_finds << ","
+                 << s.probability << std::endl;
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "inputs.h"
+
+// Havoc operators of fuzz(), in the order of its cases
+const uint32_t BYTE_OPERATORS = 16;
+// Havoc operators of fuzz_set(), for fields with a valid set
+const uint32_t SET_OPERATORS = 6;
+// The last two operators of both are the token ones, which can only be
+// picked when a field has tokens
+const uint32_t TOKEN_OPERATORS = 2;
+
+// Yield of one havoc operator on one field
+typedef struct {
+    double uses;   // Decayed counts, see OperatorSchedule::update()
+    double finds;
+    double probability;
+    uint32_t pending;      // Uses in the mutation that is being run
+    uint64_t total_uses;   // Counts since the start, for the dump
+    uint64_t total_finds;
+} OperatorStats;
+
+/**
+ * @brief Learns which havoc operators pay off on which field. Every
+ * operator a mutation used is credited when the mutation finds new
+ * coverage, and every few hundred executions the probabilities are set to
+ * the smoothed yield (finds per use) of each operator, mixed with a uniform
+ * share so that no operator is ruled out for good. Counts decay with every
+ * update, so the schedule follows the fuzzer from shallow to deep code.
+*/
+class OperatorSchedule {
+   public:
+    // The table is written to dump_path with every update
+    void init(const std::vector<Field>& fields, const std::string& dump_path);
+
+    // Draws one of the first `available` operators of a field
+    uint32_t pick(unsigned int field, uint32_t available);
+
+    // Credits the operators of the last mutation, updating the
+    // probabilities every OPERATOR_UPDATE_EXECS mutations
+    void reward(bool found);
+
+   private:
+    void update();
+    // Writes field,operator,uses,finds,probability lines as CSV
+    void dump() const;
+
+    std::vector<std::vector<OperatorStats>> stats;  // By field index
+    std::vector<std::string> field_names;
+    std::vector<const char* const*> operator_names;
+    std::string dump_path;
+    uint32_t execs = 0;
+};
+
+extern OperatorSchedule schedule;
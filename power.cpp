@@ -0,0 +1,142 @@
+#include "power.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <stdexcept>
+#include "config.h"
+#include "driver.h"
+
+PowerConfig readPowerConfig(const json& j) {
+    static const std::pair<const char*, ScheduleKind> names[] = {
+        {"exponential", ScheduleKind::EXPONENTIAL},
+        {"constant", ScheduleKind::CONSTANT},
+        {"explore", ScheduleKind::EXPLORE},
+        {"fast", ScheduleKind::FAST},
+        {"coe", ScheduleKind::COE},
+        {"lin", ScheduleKind::LIN},
+        {"quad", ScheduleKind::QUAD}};
+
+    PowerConfig config;
+    const std::string name = j.value("power_schedule", "exponential");
+    auto it = std::find_if(std::begin(names), std::end(names),
+                           [&](const auto& entry) { return name == entry.first; });
+    if (it == std::end(names))
+        throw std::runtime_error("Unknown power schedule " + name);
+    config.kind = it->second;
+
+    // Read as signed, so that a negative value is an error rather than a
+    // huge unsigned one
+    auto read_count = [&](const char* key, int64_t fallback) {
+        const int64_t value = j.value(key, fallback);
+        if (value < 0 || value > INT_MAX)
+            throw std::runtime_error(std::string(key) +
+                                     " must be from 0 to INT_MAX");
+        return static_cast<unsigned int>(value);
+    };
+    // The exponential schedule keeps the base and the missing cap it had
+    // before the other schedules came along
+    const bool exponential = config.kind == ScheduleKind::EXPONENTIAL;
+    config.base_energy = read_count(
+        "base_energy",
+        exponential ? POWER_EXPONENTIAL_BASE_ENERGY : POWER_BASE_ENERGY);
+    config.max_energy =
+        read_count("max_energy", exponential ? INT_MAX : POWER_MAX_ENERGY);
+    const std::string unit = j.value("energy_unit", "runs");
+    if (unit != "runs" && unit != "time")
+        throw std::runtime_error("Unknown energy unit " + unit);
+    config.time_energy = unit == "time";
+    config.max_seed_ms = read_count("max_seed_ms", 0);
+    if (config.base_energy < 1 || config.max_energy < config.base_energy)
+        throw std::runtime_error(
+            "Energy must be at least 1 and max_energy at least base_energy");
+    return config;
+}
+
+PowerSchedule::PowerSchedule(const PowerConfig& config)
+    : config(config), path_counts(SIZE) {}
+
+uint32_t PowerSchedule::path_count(const SeedInfo& info) const {
+    return std::max(path_counts[info.path_cksum % path_counts.size()], 1u);
+}
+
+double PowerSchedule::speed_factor(const SeedInfo& info) const {
+    // AFL's steps of calculate_score()
+    const double avg = average_exec_us();
+    const double us = info.exec_us;
+    if (us * 0.1 > avg)
+        return 0.1;
+    if (us * 0.25 > avg)
+        return 0.25;
+    if (us * 0.5 > avg)
+        return 0.5;
+    if (us * 0.75 > avg)
+        return 0.75;
+    if (us * 4 < avg)
+        return 3;
+    if (us * 3 < avg)
+        return 2;
+    if (us * 2 < avg)
+        return 1.5;
+    return 1;
+}
+
+unsigned int PowerSchedule::energy(SeedStore& corpus, uint32_t id) {
+    SeedInfo& info = corpus.info(id);
+    // Passes the seed had before this one
+    const unsigned int level = info.chosen_count;
+
+    // Seeds chosen more often than average sit this round out, and it does
+    // not count as a pass
+    if (config.kind == ScheduleKind::EXPONENTIAL &&
+        level > chosen_total / corpus.size())
+        return 0;
+    info.chosen_count++;
+    chosen_total++;
+
+    const double paths = path_count(info);
+    double factor = 1;
+    switch (config.kind) {
+        case ScheduleKind::EXPONENTIAL:
+            factor = std::pow(2.0, info.chosen_count);
+            break;
+        case ScheduleKind::CONSTANT:
+        case ScheduleKind::EXPLORE:
+            break;
+        case ScheduleKind::COE: {
+            double mean = 0;
+            uint32_t calibrated = 0;
+            for (uint32_t i = 0; i < corpus.size(); i++) {
+                if (corpus.info(i).calibrated) {
+                    mean += path_count(corpus.info(i));
+                    calibrated++;
+                }
+            }
+            if (calibrated > 0 && paths > mean / calibrated)
+                return 0;
+            factor = std::pow(2.0, std::min(level, 16u)) / paths;
+            break;
+        }
+        case ScheduleKind::FAST:
+            factor = std::pow(2.0, std::min(level, 16u)) / paths;
+            break;
+        // As published, the first pass of LIN and QUAD has a factor of 0 and
+        // gets the minimum of 1 run
+        case ScheduleKind::LIN:
+            factor = level / paths;
+            break;
+        case ScheduleKind::QUAD:
+            factor = double(level) * level / paths;
+            break;
+    }
+
+    // The exponential schedule is the old one, which grew without a factor
+    // cap and is only held by max_energy, and the constant one is meant to
+    // give every seed the same
+    if (config.kind != ScheduleKind::EXPONENTIAL)
+        factor = std::min(factor, double(POWER_MAX_FACTOR));
+    if (config.kind != ScheduleKind::EXPONENTIAL &&
+        config.kind != ScheduleKind::CONSTANT)
+        factor *= speed_factor(info);
+    const double energy = config.base_energy * factor;
+    return std::clamp(energy, 1.0, double(config.max_energy));
+}
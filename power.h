@@ -0,0 +1,75 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "corpus.h"
+#include "json.hpp"
+
+using json = nlohmann::json;
+
+// How many havoc runs a seed gets, see PowerSchedule::energy()
+enum class ScheduleKind {
+    EXPONENTIAL,  // Base times 2^passes, none above the average pass count
+    CONSTANT,     // Base for every pass
+    EXPLORE,      // Base for every pass, AFLFast's name for AFL's schedule
+    FAST,         // 2^passes over the path frequency
+    COE,          // As FAST, none for paths hit more often than average
+    LIN,          // Earlier passes over the path frequency
+    QUAD,         // Earlier passes squared over the path frequency
+};
+
+/**
+ * @brief Power schedule settings, read from the config: "power_schedule"
+ * (one of the kinds above in lower case, "exponential" by default),
+ * "base_energy" and "max_energy" in havoc runs, "energy_unit", "runs" (the default) to
+ * spend energy as that many runs or "time" to spend it as that many average
+ * run times, and "max_seed_ms", the most time a seed may take in havoc and
+ * splicing, 0 for no limit.
+*/
+typedef struct {
+    ScheduleKind kind;
+    unsigned int base_energy;
+    unsigned int max_energy;
+    bool time_energy;
+    unsigned int max_seed_ms;
+} PowerConfig;
+
+PowerConfig readPowerConfig(const json& j);
+
+/**
+ * @brief AFLFast's power schedules. Every run counts towards the frequency
+ * of its path, told apart by the coverage checksum, and seeds on rarely hit
+ * paths get more energy than those on paths most inputs take. Like AFL's
+ * performance score, the AFLFast schedules also scale energy by how fast a
+ * seed runs against the average run, from a tenth for seeds ten times
+ * slower to three times for seeds four times faster.
+*/
+class PowerSchedule {
+   public:
+    explicit PowerSchedule(const PowerConfig& config);
+
+    // Counts a run towards the frequency of its path and the average run
+    void count_run(uint32_t cksum, uint32_t exec_us) {
+        path_counts[cksum % path_counts.size()]++;
+        total_exec_us += exec_us;
+        total_runs++;
+    }
+
+    uint64_t average_exec_us() const {
+        return total_runs ? std::max<uint64_t>(total_exec_us / total_runs, 1)
+                          : 1;
+    }
+
+    // Energy of a seed for its next pass, which it counts as chosen
+    unsigned int energy(SeedStore& corpus, uint32_t id);
+
+   private:
+    uint32_t path_count(const SeedInfo& info) const;
+    double speed_factor(const SeedInfo& info) const;
+
+    PowerConfig config;
+    std::vector<uint32_t> path_counts;  // By checksum, modulo the size
+    uint64_t chosen_total = 0;          // Passes over all seeds
+    uint64_t total_exec_us = 0;         // Over all runs
+    uint64_t total_runs = 0;
+};
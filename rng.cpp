@@ -0,0 +1,73 @@
+#include "rng.h"
+#include <random>
+
+Rng rng;
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+// Spreads a seed over the generator state, as recommended for xoshiro
+static uint64_t splitmix64(uint64_t& x) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+void Rng::seed(uint64_t seed, RngKind kind) {
+    this->kind = kind;
+    for (auto& word : state)
+        word = splitmix64(seed);
+    pos = BLOCK_WORDS;
+}
+
+void Rng::refill() {
+    switch (kind) {
+        case RngKind::XOSHIRO256: {
+            uint64_t s0 = state[0], s1 = state[1], s2 = state[2],
+                     s3 = state[3];
+            for (auto& word : block) {
+                word = rotl(s1 * 5, 7) * 9;
+                uint64_t t = s1 << 17;
+                s2 ^= s0;
+                s3 ^= s1;
+                s1 ^= s2;
+                s0 ^= s3;
+                s2 ^= t;
+                s3 = rotl(s3, 45);
+            }
+            state[0] = s0, state[1] = s1, state[2] = s2, state[3] = s3;
+            break;
+        }
+        case RngKind::WYRAND: {
+            uint64_t s = state[0];
+            for (auto& word : block) {
+                s += 0xa0761d6478bd642f;
+                __uint128_t t =
+                    static_cast<__uint128_t>(s) * (s ^ 0xe7037ed1a0b428db);
+                word = static_cast<uint64_t>(t >> 64) ^ static_cast<uint64_t>(t);
+            }
+            state[0] = s;
+            break;
+        }
+    }
+    pos = 0;
+}
+
+// Seed for runs without --seed
+uint64_t random_seed() {
+    std::random_device rd;
+    return (static_cast<uint64_t>(rd()) << 32) | rd();
+}
+
+bool parse_rng_kind(const std::string& name, RngKind& kind) {
+    if (name == "xoshiro256") {
+        kind = RngKind::XOSHIRO256;
+    } else if (name == "wyrand") {
+        kind = RngKind::WYRAND;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Generators the mutators can draw from
+enum class RngKind {
+    XOSHIRO256,  // xoshiro256**, 256 bits of state
+    WYRAND,      // wyrand, a single 64 bit counter
+};
+
+/**
+ * @brief Seedable random number source of the mutators. Words are generated
+ * a block at a time, so the generator is only dispatched on once per block
+ * and its loop stays tight. Bounded numbers use Lemire's multiply and shift,
+ * which only divides when the sample falls into the biased range.
+*/
+class Rng {
+   public:
+    void seed(uint64_t seed, RngKind kind);
+
+    uint64_t next64() {
+        if (pos == BLOCK_WORDS)
+            refill();
+        return block[pos++];
+    }
+
+    // Uniform in [0, limit), limit must not be 0
+    uint32_t below(uint32_t limit) {
+        uint64_t m = (next64() >> 32) * limit;
+        uint32_t low = static_cast<uint32_t>(m);
+        if (low < limit) {
+            uint32_t threshold = -limit % limit;
+            while (low < threshold) {
+                m = (next64() >> 32) * limit;
+                low = static_cast<uint32_t>(m);
+            }
+        }
+        return m >> 32;
+    }
+
+   private:
+    static const size_t BLOCK_WORDS = 64;
+
+    void refill();
+
+    RngKind kind = RngKind::XOSHIRO256;
+    uint64_t state[4] = {};
+    uint64_t block[BLOCK_WORDS];
+    size_t pos = BLOCK_WORDS;
+};
+
+extern Rng rng;
+
+uint64_t random_seed();
+bool parse_rng_kind(const std::string& name, RngKind& kind);
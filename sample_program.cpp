@@ -3,17 +3,25 @@
 #include <cstring>
 #include <iostream>
 #include <netinet/in.h>
-#include <sqlite3.h>
 #include <stdio.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
-#include "checksum.h"
 #include "inputs.h"
 #include "sample_program.h"
 #include "driver.h"
 #include "config.h"
 
+// No structure-aware mutators, all fields go through the byte mutators
+bool mutate_structured(const Field&, std::vector<std::byte>&) {
+    return false;
+}
+
+// A TCP probe would be taken for an input, so the server reports itself
+ServerProbe server_probe() {
+    return {ProbeType::READY_LINE, 0};
+}
+
 pid_t run_server() {
 
     pid_t pid = fork();
@@ -24,7 +32,10 @@ pid_t run_server() {
     } else if (pid == 0) {
 
         // Child process
-        char* args[] = {(char*)"python", (char*)"test_coverage.py", NULL};
+        std::string port = std::to_string(server_port(4345));
+        setenv("COVERAGE_FILE", coverage_data_file().c_str(), 1);
+        char* args[] = {(char*)"python", (char*)"test_coverage.py",
+                        (char*)port.c_str(), NULL};
         execvp(args[0], args);
         // If execvp returns, an error occurred
         std::cerr << "Failed to execute Python script" << std::endl;
@@ -34,7 +45,7 @@ pid_t run_server() {
     return pid;
 }
 
-int run_driver(std::array<char, SIZE> &shm, std::vector<Input>& inputs) {
+int run_driver(coverage_map& shm, std::vector<Input>& inputs) {
     char a;
     char b;
     std::cout << inputVectorToJSON(inputs) << std::endl;
@@ -49,11 +60,11 @@ int run_driver(std::array<char, SIZE> &shm, std::vector<Input>& inputs) {
     return run_coverage_shm(shm, a, b);
 }
 
-int run_coverage_shm(std::array<char, SIZE>& shm, char a, char b) {
+int run_coverage_shm(coverage_map& shm, char a, char b) {
     // Define the server's IP address and port
     const char* SERVER_IP = "127.0.0.1";
-    const int SERVER_PORT = 4345;
-    const char* FILENAME = "data/.coverage";
+    const int SERVER_PORT = server_port(4345);
+    const std::string FILENAME = coverage_data_file();
 
     // Create a TCP socket
     int client_socket = socket(AF_INET, SOCK_STREAM, 0);
@@ -103,38 +114,9 @@ int run_coverage_shm(std::array<char, SIZE>& shm, char a, char b) {
     // Close the socket
     close(client_socket);
 
-    hash_cov_into_shm(shm, FILENAME);
+    if (!python_shm_coverage())
+        hash_cov_into_shm(shm, FILENAME.c_str());
 
     return 0;
 }
 
-int hash_cov_into_shm(std::array<char, SIZE> &shm, const char* filename) {
-    sqlite3 *db;
-    char *zErrMsg = 0;
-    int rc;
-    rc = sqlite3_open(filename, &db);
-    if( rc ) {
-        fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-        return(0);
-    } else {
-        // fprintf(stderr, "Opened database successfully\n");
-    }
-
-    const char *sql = "SELECT * from arc";
-    sqlite3_stmt *stmt; 
-    sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
-    int ncols = sqlite3_column_count(stmt);
-    int res;
-    do {
-        res = sqlite3_step(stmt);
-        uint16_t crc = 0;
-        for (int i = 0; i < ncols; i++) {
-            int item = sqlite3_column_int(stmt, i);
-            crc = update_crc_16(crc, item);
-        }
-        shm[crc]++;
-    } while (res == SQLITE_ROW);
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
-    return 0;
-}
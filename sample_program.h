@@ -2,7 +2,7 @@
 #include <array>
 #include "inputs.h"
 #include "config.h"
+#include "coverage_db.h"
 #include "driver.h"
 
-int hash_cov_into_shm(std::array<char, SIZE>& shm, const char* filename);
-int run_coverage_shm(std::array<char, SIZE>& shm, char a, char b);
\ No newline at end of file
+int run_coverage_shm(coverage_map& shm, char a, char b);
\ No newline at end of file
@@ -0,0 +1,116 @@
+#include "scheduler.h"
+#include <algorithm>
+#include "config.h"
+#include "driver.h"
+#include "rng.h"
+
+SeedScheduler::SeedScheduler(SeedStore& corpus)
+    : corpus(corpus), top_rated(SIZE, NO_SEED), covered(SIZE) {}
+
+void SeedScheduler::calibrate(uint32_t id, const std::vector<uint32_t>& edges,
+                              uint32_t cksum, uint32_t exec_us) {
+    SeedInfo& info = corpus.info(id);
+    info.calibrated = true;
+    info.exec_us = exec_us;
+    info.exec_total_us = exec_us;
+    info.exec_runs = 1;
+    info.path_cksum = cksum;
+    corpus.set_trace(id, edges);
+    update_score(id);
+}
+
+void SeedScheduler::resized(uint32_t id) {
+    update_score(id);
+}
+
+void SeedScheduler::timed(uint32_t id, uint64_t total_us, uint32_t runs) {
+    SeedInfo& info = corpus.info(id);
+    if (runs == 0)
+        return;
+    info.exec_total_us += total_us;
+    info.exec_runs += runs;
+    info.exec_us = info.exec_total_us / info.exec_runs;
+    // A seed that got slower keeps the entries it is top rated for until a
+    // better one comes along, like one that got bigger would
+    update_score(id);
+}
+
+void SeedScheduler::fuzzed(uint32_t id) {
+    SeedInfo& info = corpus.info(id);
+    if (info.was_fuzzed)
+        return;
+    info.was_fuzzed = true;
+    if (info.favored)
+        pending_favored--;
+}
+
+uint64_t SeedScheduler::fav_factor(uint32_t id) const {
+    const SeedInfo& info = corpus.info(id);
+    return uint64_t(info.size + 1) * info.exec_us;
+}
+
+void SeedScheduler::update_score(uint32_t id) {
+    const uint64_t factor = fav_factor(id);
+    const uint32_t* edges = corpus.trace(id);
+    for (uint32_t i = 0; i < corpus.info(id).edge_count; i++) {
+        uint32_t& top = top_rated[edges[i]];
+        if (top == id ||
+            (top != NO_SEED && fav_factor(top) <= factor))
+            continue;
+        top = id;
+        score_changed = true;
+    }
+}
+
+void SeedScheduler::cull() {
+    score_changed = false;
+    pending_favored = 0;
+    std::fill(covered.begin(), covered.end(), 0);
+    for (uint32_t id = 0; id < corpus.size(); id++)
+        corpus.info(id).favored = false;
+
+    // A top rated seed covers all its entries, so each is favored once
+    for (uint32_t entry = 0; entry < SIZE; entry++) {
+        const uint32_t id = top_rated[entry];
+        if (id == NO_SEED || covered[entry])
+            continue;
+        const uint32_t* edges = corpus.trace(id);
+        for (uint32_t i = 0; i < corpus.info(id).edge_count; i++)
+            covered[edges[i]] = 1;
+        corpus.info(id).favored = true;
+        if (!corpus.info(id).was_fuzzed)
+            pending_favored++;
+    }
+}
+
+uint32_t SeedScheduler::next() {
+    while (true) {
+        if (score_changed)
+            cull();
+        if (cursor >= corpus.size()) {
+            cursor = 0;
+            cycle++;
+        }
+        const uint32_t id = cursor++;
+        const SeedInfo& info = corpus.info(id);
+
+        // Seeds are calibrated on their first pass, until then nothing
+        // tells whether they are worth it
+        if (!info.calibrated)
+            return id;
+
+        if (pending_favored > 0) {
+            if ((info.was_fuzzed || !info.favored) &&
+                rng.below(100) < SKIP_TO_NEW_PROB)
+                continue;
+        } else if (!info.favored && corpus.size() > 10) {
+            if (cycle > 1 && !info.was_fuzzed) {
+                if (rng.below(100) < SKIP_NFAV_NEW_PROB)
+                    continue;
+            } else if (rng.below(100) < SKIP_NFAV_OLD_PROB) {
+                continue;
+            }
+        }
+        return id;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "corpus.h"
+
+/**
+ * @brief Picks the seed to fuzz next, with AFL's favored seeds. Every entry
+ * of the coverage map keeps its top rated seed, the one hitting it with the
+ * smallest size times average exec time. Walking the entries, each top rated seed
+ * that hits an entry not covered yet is favored, which gives a small set of
+ * seeds covering everything the corpus covers. The seeds are gone round in
+ * order like a queue, but most of those outside the favored set are
+ * skipped, and while favored seeds wait for their first pass almost all
+ * others are.
+*/
+class SeedScheduler {
+   public:
+    explicit SeedScheduler(SeedStore& corpus);
+
+    // Records the trace, checksum and exec time of a seed's run
+    void calibrate(uint32_t id, const std::vector<uint32_t>& edges,
+                   uint32_t cksum, uint32_t exec_us);
+    // Scores a seed again after it got smaller
+    void resized(uint32_t id);
+    // Adds the runs of a pass over the seed to its average exec time
+    void timed(uint32_t id, uint64_t total_us, uint32_t runs);
+    void fuzzed(uint32_t id);
+
+    uint32_t next();
+
+   private:
+    static constexpr uint32_t NO_SEED = UINT32_MAX;
+
+    uint64_t fav_factor(uint32_t id) const;
+    void update_score(uint32_t id);
+    void cull();
+
+    SeedStore& corpus;
+    std::vector<uint32_t> top_rated;  // By coverage map entry
+    std::vector<uint8_t> covered;     // Entries covered while culling
+    bool score_changed = false;
+    uint32_t pending_favored = 0;     // Favored seeds without a pass yet
+    uint32_t cursor = 0;
+    uint64_t cycle = 1;
+};
@@ -0,0 +1,440 @@
+#include "server.h"
+#include <arpa/inet.h>   // For inet_pton and htons
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>  // For SYS_pidfd_open
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "driver.h"
+
+// Probes start often and back off, servers under gdb take seconds to start
+const int PROBE_INTERVAL_MIN_MS = 5;
+const int PROBE_INTERVAL_MAX_MS = 200;
+const int READY_TIMEOUT_MS = 60000;
+
+// Delay between failed starts, doubling up to the maximum
+const int START_BACKOFF_MIN_MS = 100;
+const int START_BACKOFF_MAX_MS = 5000;
+const int START_ATTEMPTS = 6;
+
+// How long a server gets to exit after SIGTERM before it is killed
+const int STOP_TIMEOUT_MS = 2000;
+
+static int64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static bool server_exited(pid_t pid, int* status = nullptr) {
+    int s;
+    if (waitpid(pid, &s, WNOHANG) != pid)
+        return false;
+    if (status)
+        *status = s;
+    return true;
+}
+
+static sockaddr_in local_address(uint16_t port) {
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    return addr;
+}
+
+static bool probe_tcp(uint16_t port) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    auto addr = local_address(port);
+    bool ready = connect(sock, (sockaddr*)&addr, sizeof(addr)) == 0;
+    close(sock);
+    return ready;
+}
+
+/**
+ * @brief Sends a confirmable GET without options and waits for any answer.
+ * An empty CoAP ping would be lighter, but CoAPthon does not answer those.
+*/
+static bool probe_coap(uint16_t port, int timeout_ms) {
+    static uint16_t mid = 0;
+    mid++;
+    const uint8_t request[] = {0x40, 0x01, static_cast<uint8_t>(mid >> 8),
+                               static_cast<uint8_t>(mid & 0xFF)};
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    auto addr = local_address(port);
+    sendto(sock, request, sizeof(request), 0, (sockaddr*)&addr, sizeof(addr));
+
+    struct pollfd pfd = {sock, POLLIN, 0};
+    uint8_t reply[1024];
+    bool ready = poll(&pfd, 1, timeout_ms) == 1 &&
+                 recv(sock, reply, sizeof(reply), 0) > 0;
+    close(sock);
+    return ready;
+}
+
+static bool probe_ready_line(int fd, int timeout_ms) {
+    struct pollfd pfd = {fd, POLLIN, 0};
+    char line[16] = {};
+    return poll(&pfd, 1, timeout_ms) == 1 &&
+           read(fd, line, sizeof(line) - 1) > 0 &&
+           strncmp(line, "ready", 5) == 0;
+}
+
+/**
+ * @brief Probes the server with a growing interval until it is ready.
+ *
+ * @return False if the server exited or did not get ready in time.
+*/
+static bool wait_until_ready(pid_t pid, const ServerProbe& probe,
+                             int ready_fd) {
+    auto deadline = now_us() + READY_TIMEOUT_MS * 1000LL;
+    int interval = PROBE_INTERVAL_MIN_MS;
+    while (now_us() < deadline) {
+        if (server_exited(pid))
+            return false;
+
+        bool ready = false;
+        switch (probe.type) {
+            case ProbeType::NONE:
+                return true;
+            case ProbeType::TCP_CONNECT:
+                ready = probe_tcp(probe.port);
+                break;
+            case ProbeType::COAP_PING:
+                // Waiting for the answer already spaces out the probes
+                ready = probe_coap(probe.port, interval);
+                break;
+            case ProbeType::READY_LINE:
+                ready = probe_ready_line(ready_fd, interval);
+                break;
+        }
+        if (ready)
+            return true;
+
+        if (probe.type == ProbeType::TCP_CONNECT) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(interval));
+        }
+        interval = std::min(interval * 2, PROBE_INTERVAL_MAX_MS);
+    }
+    return false;
+}
+
+/**
+ * @brief Waits for the server to exit, on a pidfd where the kernel has them.
+ *
+ * @return False if it was still running after the timeout.
+*/
+static bool wait_exit(pid_t pid, int timeout_ms) {
+#ifdef SYS_pidfd_open
+    int pidfd = syscall(SYS_pidfd_open, pid, 0);
+    if (pidfd != -1) {
+        struct pollfd pfd = {pidfd, POLLIN, 0};
+        poll(&pfd, 1, timeout_ms);
+        close(pidfd);
+        return server_exited(pid);
+    }
+#endif
+    for (int waited = 0; waited < timeout_ms; waited += 10) {
+        if (server_exited(pid))
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return server_exited(pid);
+}
+
+// Servers that run in their own process group are stopped as a whole
+static void signal_server(pid_t pid, int sig) {
+    if (getpgid(pid) == pid)
+        kill(-pid, sig);
+    else
+        kill(pid, sig);
+}
+
+void stop_server(pid_t pid) {
+    if (pid <= 0 || server_exited(pid))
+        return;
+    signal_server(pid, SIGTERM);
+    if (!wait_exit(pid, STOP_TIMEOUT_MS)) {
+        signal_server(pid, SIGKILL);
+        waitpid(pid, nullptr, 0);
+    }
+}
+
+/**
+ * @brief A server instance on one of the worker's ports. Besides the active
+ * instance there are standbys that warm up in the background, and failed
+ * instances that are still being stopped.
+*/
+typedef struct {
+    pid_t pid = -1;                // -1 if the slot is free
+    int ready_fd = -1;             // Read end of the READY_LINE pipe
+    bool ready = false;            // Whether it answered its probe
+    int64_t stop_deadline_us = 0;  // When to kill it, if it is being stopped
+    int64_t retry_at_us = 0;       // When to start a standby after a failure
+    int backoff_ms = START_BACKOFF_MIN_MS;
+} ServerSlot;
+
+int standby_servers = 1;
+int server_instance = 0;
+
+static std::vector<ServerSlot> slots;
+static ServerProbe probe;
+static pid_t pool_owner = -1;
+
+// Starts the server of a slot without waiting for it
+static void spawn_server(int slot) {
+    auto& server = slots[slot];
+    int ready_pipe[2] = {-1, -1};
+    if (probe.type == ProbeType::READY_LINE) {
+        // The server inherits the write end through its environment
+        if (pipe(ready_pipe) == -1) {
+            perror("Error creating server ready pipe");
+            exit(1);
+        }
+        setenv(SERVER_READY_ENV, std::to_string(ready_pipe[1]).c_str(), 1);
+    }
+
+    int active = server_instance;
+    server_instance = slot;
+    server.pid = run_server();
+    server_instance = active;
+
+    if (probe.type == ProbeType::READY_LINE) {
+        unsetenv(SERVER_READY_ENV);
+        close(ready_pipe[1]);
+    }
+    server.ready_fd = ready_pipe[0];
+    server.ready = false;
+    server.stop_deadline_us = 0;
+}
+
+// Frees a slot whose server has exited
+static void release_slot(int slot) {
+    auto& server = slots[slot];
+    if (server.ready_fd != -1)
+        close(server.ready_fd);
+    server.pid = -1;
+    server.ready_fd = -1;
+    server.ready = false;
+    server.stop_deadline_us = 0;
+}
+
+// Asks the server of a slot to exit, tend_servers() reaps it later
+static void begin_stop(int slot) {
+    auto& server = slots[slot];
+    if (server_exited(server.pid)) {
+        release_slot(slot);
+        return;
+    }
+    signal_server(server.pid, SIGTERM);
+    server.stop_deadline_us = now_us() + STOP_TIMEOUT_MS * 1000LL;
+}
+
+static void finish_stop(int slot) {
+    stop_server(slots[slot].pid);
+    release_slot(slot);
+}
+
+static bool await_ready(int slot) {
+    auto& server = slots[slot];
+    int active = server_instance;
+    server_instance = slot;
+    auto slot_probe = server_probe();
+    server_instance = active;
+
+    server.ready = server.pid > 0 &&
+                   wait_until_ready(server.pid, slot_probe, server.ready_fd);
+    if (server.ready_fd != -1) {
+        close(server.ready_fd);
+        server.ready_fd = -1;
+    }
+    return server.ready;
+}
+
+static bool is_standby(int slot) {
+    return slot != server_instance && slots[slot].pid > 0 &&
+           slots[slot].stop_deadline_us == 0;
+}
+
+/**
+ * @brief Starts a server in a slot and waits until it accepts inputs.
+ * Starts that fail are retried with an exponential backoff.
+*/
+static void start_in_slot(int slot) {
+    int backoff = START_BACKOFF_MIN_MS;
+    for (int attempt = 1; attempt <= START_ATTEMPTS; attempt++) {
+        spawn_server(slot);
+        if (await_ready(slot))
+            return;
+
+        std::cerr << "Server did not get ready (attempt " << attempt << " of "
+                  << START_ATTEMPTS << ")" << std::endl;
+        finish_stop(slot);
+        std::this_thread::sleep_for(std::chrono::milliseconds(backoff));
+        backoff = std::min(backoff * 2, START_BACKOFF_MAX_MS);
+    }
+    std::cerr << "Giving up on starting the server" << std::endl;
+    exit(1);
+}
+
+/**
+ * @brief Reaps stopped servers and starts standbys until there are
+ * standby_servers of them. Cheap enough to call after every seed.
+*/
+void tend_servers() {
+    auto now = now_us();
+    int standbys = 0;
+    for (int slot = 0; slot < (int)slots.size(); slot++) {
+        auto& server = slots[slot];
+        if (server.pid <= 0 || slot == server_instance)
+            continue;
+        if (server.stop_deadline_us != 0) {
+            if (server_exited(server.pid)) {
+                release_slot(slot);
+            } else if (now >= server.stop_deadline_us) {
+                signal_server(server.pid, SIGKILL);
+                waitpid(server.pid, nullptr, 0);
+                release_slot(slot);
+            }
+        } else if (server_exited(server.pid)) {
+            // Died while warming up, wait a bit before the next try
+            release_slot(slot);
+            server.retry_at_us = now + server.backoff_ms * 1000LL;
+            server.backoff_ms = std::min(server.backoff_ms * 2,
+                                         START_BACKOFF_MAX_MS);
+        } else {
+            standbys++;
+        }
+    }
+
+    for (int slot = 0; slot < (int)slots.size() && standbys < standby_servers;
+         slot++) {
+        if (slots[slot].pid == -1 && now >= slots[slot].retry_at_us) {
+            spawn_server(slot);
+            standbys++;
+        }
+    }
+}
+
+void stop_all_servers() {
+    if (getpid() != pool_owner)
+        return;  // A forked child that has not reached exec yet
+    for (int slot = 0; slot < (int)slots.size(); slot++) {
+        if (slots[slot].pid > 0)
+            finish_stop(slot);
+    }
+}
+
+volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int) {
+    stop_requested = 1;
+}
+
+void catch_stop_signals() {
+    struct sigaction action {};
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    // Only the first signal is caught, in case the loop does not get to
+    // the next input
+    action.sa_flags = SA_RESTART | SA_RESETHAND;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+}
+
+void wait_for_workers(const std::vector<pid_t>& pids) {
+    bool passed_on = false;
+    for (auto pid : pids) {
+        int status;
+        pid_t waited;
+        while ((waited = waitpid(pid, &status, WNOHANG)) == 0) {
+            if (stop_requested && !passed_on) {
+                for (auto worker : pids)
+                    kill(worker, SIGTERM);
+                passed_on = true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+        if (waited == pid && WIFSIGNALED(status)) {
+            std::cerr << "Worker " << pid << " terminated due to signal "
+                      << WTERMSIG(status) << std::endl;
+        }
+    }
+}
+
+/**
+ * @brief Starts the active server of the worker and its standbys. Only the
+ * active server is waited for.
+*/
+pid_t start_server() {
+    probe = server_probe();
+    if (probe.type == ProbeType::NONE)
+        standby_servers = 0;  // Nothing to wait for, so nothing to save
+
+    // One slot more than servers wanted, for a failed server being stopped
+    slots.resize(standby_servers + 2);
+    pool_owner = getpid();
+    atexit(stop_all_servers);
+
+    server_instance = 0;
+    start_in_slot(server_instance);
+    tend_servers();
+    return slots[server_instance].pid;
+}
+
+/**
+ * @brief Replaces a server after a failed input. A server that has exited
+ * crashed, one that is still running hangs. A standby takes over, and only
+ * if there is none the new server is waited for.
+*/
+ServerRestart restart_server(pid_t& pid) {
+    auto start = now_us();
+    ServerRestart restart{ServerFailure::HANG, 0, 0};
+    int failed = server_instance;
+    if (server_exited(pid, &restart.status)) {
+        restart.failure = ServerFailure::CRASH;
+        release_slot(failed);
+    } else {
+        begin_stop(failed);
+    }
+
+    // Take over the first standby that is ready
+    int next = -1;
+    for (int slot = 0; slot < (int)slots.size() && next == -1; slot++) {
+        if (!is_standby(slot))
+            continue;
+        if (slots[slot].ready || await_ready(slot)) {
+            slots[slot].backoff_ms = START_BACKOFF_MIN_MS;
+            next = slot;
+        } else {
+            begin_stop(slot);
+        }
+    }
+
+    if (next == -1) {
+        // No standby, so start a new server and wait for it. It needs the
+        // port of the failed server if no other one is free.
+        for (int slot = 0; slot < (int)slots.size() && next == -1; slot++) {
+            if (slots[slot].pid == -1)
+                next = slot;
+        }
+        if (next == -1) {
+            next = failed;
+            finish_stop(failed);
+        }
+        start_in_slot(next);
+    }
+    server_instance = next;
+    pid = slots[next].pid;
+    tend_servers();
+    restart.latency_us = now_us() - start;
+    return restart;
+}
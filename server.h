@@ -0,0 +1,55 @@
+#pragma once
+#include <sys/types.h>
+#include <csignal>
+#include <cstdint>
+#include <vector>
+
+// How to tell that a freshly started server accepts inputs
+enum class ProbeType {
+    NONE,         // Ready as soon as it runs
+    COAP_PING,    // Answers a CoAP request on a UDP port
+    TCP_CONNECT,  // Accepts connections on a TCP port
+    READY_LINE,   // Writes "ready" to the pipe in SERVER_READY_ENV
+};
+
+typedef struct {
+    ProbeType type;
+    uint16_t port;
+} ServerProbe;
+
+// Environment variable holding the pipe for READY_LINE probes
+#define SERVER_READY_ENV "FUZZ_READY_FD"
+
+// Why the server had to be restarted
+enum class ServerFailure { CRASH, HANG };
+
+typedef struct {
+    ServerFailure failure;
+    int status;          // Wait status of a crashed server
+    int64_t latency_us;  // From the failure until the new server was ready
+} ServerRestart;
+
+// Number of ready servers each worker keeps on spare ports, so that a failed
+// server can be replaced without waiting for a new one to start
+extern int standby_servers;
+
+// Index of the server instance the driver talks to, see server_port()
+extern int server_instance;
+
+// Ports of different workers and server instances are this far apart
+const int INSTANCE_PORT_STRIDE = 100;
+
+// Set by SIGINT and SIGTERM once catch_stop_signals() was called. The fuzz
+// loop and cmin stop at the next input and clean up, a second signal kills
+// the process at once.
+extern volatile sig_atomic_t stop_requested;
+void catch_stop_signals();
+// Waits for forked workers, passing a stop on to them in case it was only
+// sent to this process and not to the whole process group
+void wait_for_workers(const std::vector<pid_t>& pids);
+
+pid_t start_server();
+ServerRestart restart_server(pid_t& pid);
+void tend_servers();
+void stop_server(pid_t pid);
+void stop_all_servers();
@@ -0,0 +1,63 @@
+#include "shm.h"
+#include <fcntl.h>     // For O_* constants
+#include <sys/mman.h>  // For shm_open, mmap
+#include <unistd.h>    // For ftruncate, close
+#include <cerrno>      // For errno
+#include <cstring>     // For strerror
+#include <stdexcept>
+
+/**
+ * @brief Maps a POSIX shared memory object into this process.
+ * 
+ * @param name Name of the shared memory object, starting with a '/'.
+ * @param size Size of the region in bytes.
+ * @param create Whether to create (and zero) the object if it does not exist.
+*/
+static void* map_region(const std::string& name, size_t size, bool create) {
+    int flags = create ? O_CREAT | O_RDWR : O_RDWR;
+    int fd = shm_open(name.c_str(), flags, 0666);
+    if (fd == -1) {
+        throw std::runtime_error("shm_open failed for " + name + ": " +
+                                 strerror(errno));
+    }
+    if (create && ftruncate(fd, size) == -1) {
+        close(fd);
+        throw std::runtime_error("ftruncate failed for " + name + ": " +
+                                 strerror(errno));
+    }
+
+    void* region =
+        mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    // The mapping keeps the object alive, the descriptor is not needed anymore
+    close(fd);
+    if (region == MAP_FAILED) {
+        throw std::runtime_error("mmap failed for " + name + ": " +
+                                 strerror(errno));
+    }
+    return region;
+}
+
+/**
+ * @brief Creates a zero-filled shared memory region that survives fork() and
+ * can be attached to by other processes using its name.
+*/
+void* create_shared_region(const std::string& name, size_t size) {
+    // Get rid of leftovers from a previous run that was killed
+    shm_unlink(name.c_str());
+    return map_region(name, size, true);
+}
+
+/**
+ * @brief Attaches to a shared memory region created by another process.
+*/
+void* attach_shared_region(const std::string& name, size_t size) {
+    return map_region(name, size, false);
+}
+
+/**
+ * @brief Removes the name of a shared memory region. Existing mappings stay
+ * valid until they are unmapped.
+*/
+void remove_shared_region(const std::string& name) {
+    shm_unlink(name.c_str());
+}
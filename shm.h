@@ -0,0 +1,7 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+void* create_shared_region(const std::string& name, size_t size);
+void* attach_shared_region(const std::string& name, size_t size);
+void remove_shared_region(const std::string& name);
@@ -27,6 +27,8 @@ plt.plot(df['Time'], df['Cumulative_All'], label='All')
 
 
 eff_df = pd.read_csv(effi_path, names=['Time', 'Seed_Gen', 'Interesting', 'Crashes', 'Mut_Time', 'Driv_Time'])
+# The effi times are in microseconds
+eff_df[['Time', 'Mut_Time', 'Driv_Time']] /= 1000
 stats = f'Total seed/runs: {eff_df["Seed_Gen"].sum()}\n'
 stats += f'Avg time (ms): {((eff_df["Time"].sum()/eff_df["Seed_Gen"].sum())):.4f}\n'
 stats += f'Total interesting: {eff_df["Interesting"].sum()}\n'
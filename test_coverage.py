@@ -1,6 +1,10 @@
 import coverage
 import atexit
+import os
 import socket
+import sys
+
+import fuzz_coverage
 
 def fn(x: int, y:int):
     """Just a random function for demo purposes"""
@@ -41,14 +45,26 @@ def main():
         cov.save()
         s.close()
 
-    cov = coverage.Coverage(branch=True, config_file=".coveragearc")
-    s = open_tcp(4345)
+    if fuzz_coverage.enabled():
+        cov = fuzz_coverage.ShmCoverage(os.path.dirname(os.path.abspath(__file__)))
+    else:
+        cov = coverage.Coverage(branch=True, config_file=".coveragearc")
+    port = int(sys.argv[1]) if len(sys.argv) > 1 else 4345
+    s = open_tcp(port)
     atexit.register(atexit_handler)
 
+    # Tell the fuzzer that connections are accepted now
+    if "FUZZ_READY_FD" in os.environ:
+        ready_fd = int(os.environ["FUZZ_READY_FD"])
+        os.write(ready_fd, b"ready\n")
+        os.close(ready_fd)
+
     while True:
         conn, addr = s.accept()
         x = int.from_bytes(conn.recv(1), "little")
         y = int.from_bytes(conn.recv(1), "little")
+        # Each request writes a data file of its own arcs only
+        cov.erase()
         cov.start()
         fn(int(x), int(y))
         cov.stop()